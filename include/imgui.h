@@ -23,7 +23,7 @@
 #define IMGUI_H
 
 #include <stdint.h>
-#include <string>
+#include <string_view>
 #include <vector>
 
 namespace imgui
@@ -41,6 +41,16 @@ namespace imgui
         ALIGN_RIGHT
     };
 
+    // Layers are drawn in this order, each one over the previous ones.
+    enum DrawLayer : uint8_t
+    {
+        LAYER_BACKGROUND,
+        LAYER_MAIN,
+        LAYER_OVERLAY,
+        LAYER_FOREGROUND,
+        LAYER_COUNT
+    };
+
     inline uint32_t RGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xff)
     {
         return r | (g << 8) | (b << 16) | (a << 24);
@@ -65,14 +75,15 @@ namespace imgui
     {
         float x, y, w, h;
         unsigned int texture;
-        float tx0, ty0, tx1, ty1;
+        uint32_t texCoords; // offset of tx0, ty0, tx1, ty1 in the render arena
     };
 
     struct gfxText
     {
         float x, y, pointSize;
+        uint32_t offset;    // offset of the text bytes in the render arena
+        uint32_t length;
         TextAlign align;
-        std::string text;
     };
 
     struct gfxLine
@@ -80,16 +91,80 @@ namespace imgui
         float x0, y0, x1, y1, r;
     };
 
+    // Trivially copyable render command. Variable sized payloads (text,
+    // texture coordinates) are stored in the owning gfxCmdQueue's arena.
     struct gfxCmd
     {
         char type;
         char flags;
         char pad[2];
         unsigned int col;
-        gfxLine line;
-        gfxRect rect;
-        gfxText text;
-        gfxTexturedRect texturedRect;
+        union
+        {
+            gfxLine line;
+            gfxRect rect;
+            gfxText text;
+            gfxTexturedRect texturedRect;
+        };
+    };
+    static_assert(sizeof(gfxCmd) == 32, "gfxCmd should stay 32 bytes");
+
+    struct gfxBox
+    {
+        float x0, y0, x1, y1;
+    };
+
+    struct gfxDamageRect
+    {
+        int x, y, w, h;
+    };
+
+    // Content hash and clipped screen bounds of one drawing command.
+    struct gfxCmdKey
+    {
+        uint64_t key;
+        gfxBox bounds;
+    };
+
+    // Conservative screen space bounds of a drawing command.
+    gfxBox gfxCmdBounds(const gfxCmd& cmd, const char* arena);
+
+    // One command list per layer, all sharing a single arena. Scissor
+    // commands only apply within their own layer.
+    struct gfxCmdQueue
+    {
+        std::vector<gfxCmd> layers[LAYER_COUNT];
+        std::vector<char> arena;
+        uint64_t hash = 0;      // rolling hash of layers and arena
+        bool unchanged = false; // same commands as the frame before
+
+        // Filled by endFrame() when Imgui::trackDamage is set: disjoint
+        // rects covering every pixel that differs from the previous frame.
+        std::vector<gfxCmdKey> keys;
+        std::vector<gfxDamageRect> damage;
+
+        void clear()
+        {
+            for (std::vector<gfxCmd>& cmds : layers)
+            {
+                cmds.clear();
+            }
+            arena.clear();
+            hash = 0;
+            unchanged = false;
+            keys.clear();
+            damage.clear();
+        }
+
+        size_t size() const
+        {
+            size_t n = 0;
+            for (const std::vector<gfxCmd>& cmds : layers)
+            {
+                n += cmds.size();
+            }
+            return n;
+        }
     };
 
     struct GuiState
@@ -126,6 +201,14 @@ namespace imgui
         int focusBottom          = 0;
         uint32_t scrollId        = 0;
         bool insideScrollArea    = false;
+        DrawLayer layer          = LAYER_MAIN;
+        DrawLayer scrollLayer    = LAYER_MAIN;
+        bool clipToScroll        = false;
+        float clipperTop         = 0;
+        float clipperHeight      = 0;
+        uint32_t clipperId       = 0;
+        uint32_t clipperRowIds   = 0;
+        int clipperCount         = 0;
         float x0, y0, x1, y1;
     };
 
@@ -134,7 +217,7 @@ namespace imgui
         void beginFrame(int mouseX, int mouseY, MouseButton mbut, int scroll);
         void endFrame();
 
-        bool beginScrollArea(const std::string& name, int x, int y, int w, int h, int& scroll);
+        bool beginScrollArea(std::string_view name, int x, int y, int w, int h, int& scroll);
         void endScrollArea();
 
         void indent(float scale = 1.f);
@@ -144,29 +227,50 @@ namespace imgui
 
         void renderPort(float x, float y, float w);
 
-        bool button  (const std::string& name, bool enabled = true);
-        bool item    (const std::string& name, bool enabled = true);
-        bool check   (const std::string& name, bool checked, bool enabled = true);
-        bool collapse(const std::string& name, const std::string& subText, bool checked, bool enabled = true);
-        void label   (const std::string& name, TextAlign align = ALIGN_LEFT, bool dontMove = false, float scale = 1.f);
-        void value   (const std::string& name, TextAlign align = ALIGN_RIGHT, float scale = 1.f);
-        bool slider  (const std::string& name, float& value, float vmin, float vmax, float vinc, bool enabled = true, float scale = 1.f);
+        // Layer subsequent commands are recorded into, reset to LAYER_MAIN
+        // by beginFrame(). Scissors are per-layer state: a scroll area clips
+        // only the layer it was begun in, and endScrollArea() closes its
+        // scissor there even if the layer was changed in between.
+        void setLayer(DrawLayer layer);
+
+        // Virtualised list of count rows of rowHeight each: returns the rows
+        // [first, last) intersecting the scroll area and moves the layout to
+        // the first of them; endClipper() then moves it past the last row.
+        // Each row must create exactly idsPerRow interactive widgets, so
+        // skipped rows can advance widget ids and ids stay put on scroll.
+        void beginClipper(int count, float rowHeight, int& first, int& last, int idsPerRow = 0);
+        void endClipper();
 
-        void labelledValue(const std::string& name, const std::string& value, float scale = 1.f);
+        bool button  (std::string_view name, bool enabled = true);
+        bool item    (std::string_view name, bool enabled = true);
+        bool check   (std::string_view name, bool checked, bool enabled = true);
+        bool collapse(std::string_view name, std::string_view subText, bool checked, bool enabled = true);
+        void label   (std::string_view name, TextAlign align = ALIGN_LEFT, bool dontMove = false, float scale = 1.f);
+        void value   (std::string_view name, TextAlign align = ALIGN_RIGHT, float scale = 1.f);
+        bool slider  (std::string_view name, float& value, float vmin, float vmax, float vinc, bool enabled = true, float scale = 1.f);
 
-        void drawText(int x, int y, TextAlign align, const std::string& text, uint32_t color, float pointSize = 8.f);
+        void labelledValue(std::string_view name, std::string_view value, float scale = 1.f);
+
+        void drawText(int x, int y, TextAlign align, std::string_view text, uint32_t color, float pointSize = 8.f);
         void drawLine(float x0, float y0, float x1, float y1, float r, uint32_t color);
         void drawRoundedRect(float x, float y, float w, float h, float r, uint32_t color);
         void drawRect(float x, float y, float w, float h, uint32_t color);
         void drawTexturedRect(float x, float y, float w, float h, uint32_t color, unsigned int texture, float tx0, float ty0, float tx1, float ty1);
 
-        std::vector<gfxCmd> renderQueue;
+        // Commands are recorded into renderQueue and handed over to
+        // frameQueue by endFrame(); the renderer only reads frameQueue and
+        // both buffers keep their capacity from frame to frame.
+        gfxCmdQueue renderQueue;
+        gfxCmdQueue frameQueue;
+        bool trackDamage = false;
+        std::vector<gfxBox> damageBoxes;
 
         GuiState state;
         bool anyActive();
         bool isActive(uint32_t id);
         bool isHot(uint32_t id);
         bool inRect(int x, int y, int w, int h, bool checkScroll = true);
+        bool isClipped(float y, float h);
         void clearInput();
         void clearActive();
         void setActive(uint32_t id);
@@ -175,13 +279,21 @@ namespace imgui
         void updateInput(int mx, int my, MouseButton mbut, int scroll);
 
         void resetGfxCmdQueue();
+        uint32_t addGfxData(const void* data, uint32_t size, uint32_t align = 1);
+        void addGfxCmd(const gfxCmd& cmd);
+        void updateDamage();
+
+        // Optional pass between endFrame() and drawing: drops commands that
+        // cannot affect the output, folds redundant scissor changes and
+        // merges abutting rects. Returns the number of commands removed.
+        unsigned optimizeGfxCmdQueue();
         void addGfxCmdScissor(int x, int y, int w, int h);
         void addGfxCmdRect(float x, float y, float w, float h, uint32_t color);
         void addGfxCmdTexturedRect(float x, float y, float w, float h, uint32_t color, uint32_t texture, float tx0, float ty0, float tx1, float ty1);
         void addGfxCmdLine(float x0, float y0, float x1, float y1, float r, uint32_t color);
         void addGfxCmdRoundedRect(float x, float y, float w, float h, float r, uint32_t color);
         void addGfxCmdTriangle(int x, int y, int w, int h, int flags, uint32_t color);
-        void addGfxCmdText(int x, int y, TextAlign align, const std::string& text, uint32_t color, float pointSize = 8.f);
+        void addGfxCmdText(int x, int y, TextAlign align, std::string_view text, uint32_t color, float pointSize = 8.f);
     };
 }
 
@@ -26,40 +26,285 @@
 #include <GL/glew.h>
 #include <GL/gl.h>
 
+#include <string>
+#include <vector>
+
 #include "imgui.h"
 #include "stb_truetype.h"
 
 namespace imgui
 {
     const unsigned TEMP_COORD_COUNT = 100;
-    const int CIRCLE_VERTS = 8*4;
+    // Rounded corners use 1 << level segments per quadrant, for level in
+    // [0, CIRCLE_LEVELS), the fewest that keep the arc within
+    // CIRCLE_TOLERANCE pixels of the true circle.
+    const unsigned CIRCLE_LEVELS = 5;
+    const unsigned CIRCLE_MAX_VERTS = 4 << (CIRCLE_LEVELS - 1);
+    const float CIRCLE_TOLERANCE = 0.25f;
+    static_assert((CIRCLE_MAX_VERTS/4 + 1)*4 <= TEMP_COORD_COUNT, "rounded rects must fit tempCoords");
+    const unsigned RING_REGIONS = 3;
+    const unsigned VERTEX_ATTRIBS = 6;
+    const unsigned MAX_CLIPS = 16; // size of Clips[] in the shader
+    const unsigned TESS_CACHE_SETS = 16;
+    const unsigned TESS_CACHE_WAYS = 4;
+
+    struct RenderBatch
+    {
+        uint64_t key;
+        gfxBox bounds;
+        uint32_t count;
+    };
+
+    struct RenderStats
+    {
+        unsigned commands = 0;
+        unsigned drawCalls = 0;
+        unsigned stateChanges = 0; // texture switches between commands
+        unsigned vertices = 0;
+        unsigned uploadBytes = 0;  // vertex and index data sent to the GPU
+        unsigned glCalls = 0;      // state calls that reached GL
+        unsigned glCallsElided = 0;  // state calls dropped as redundant
+        unsigned tessCacheHits = 0;
+        unsigned tessCacheMisses = 0;
+    };
+
+    // Shadow copy of the GL state the renderer sets, so calls that would
+    // not change anything are dropped. Global state is forgotten at the
+    // start of each draw() because the application may change it between
+    // frames; state held by the renderer's own VAO is kept.
+    struct GLStateCache
+    {
+        static const GLuint UNKNOWN = ~0u;
+
+        GLuint program = UNKNOWN;
+        GLuint activeUnit = UNKNOWN;
+        GLuint textures[2] = {UNKNOWN, UNKNOWN};
+        GLuint vertexArray = UNKNOWN;
+        GLuint arrayBuffer = UNKNOWN;
+        int scissorTest = -1;
+        bool scissorValid = false;
+        GLint scissorRect[4] = {0, 0, 0, 0};
+        GLint viewport[4] = {0, 0, 0, 0};
+        bool viewportValid = false;
+
+        // Vertex array state.
+        GLuint elementBuffer = UNKNOWN;
+        int attribs[VERTEX_ATTRIBS] = {-1, -1, -1, -1, -1, -1};
+        GLuint formatBuffer = UNKNOWN;
+        size_t formatOffset = 0;
+
+        unsigned issued = 0;
+        unsigned elided = 0;
+
+        void invalidate(bool keepVertexArrayState);
+        bool changed(bool differs, unsigned calls = 1);
+
+        void useProgram(GLuint p);
+        void bindTexture(GLuint unit, GLuint texture);
+        void bindVertexArray(GLuint vao);
+        void bindBuffer(GLenum target, GLuint buffer);
+        void enableAttrib(GLuint index, bool enable);
+        void enableScissor(bool enable);
+        void setScissor(const GLint* rect);
+        void setViewport(GLint x, GLint y, GLint w, GLint h);
+    };
+
+    // How the fragment shader colours a vertex.
+    enum VertexMode : uint8_t
+    {
+        VERTEX_SOLID,
+        VERTEX_FONT,    // coverage from the font atlas
+        VERTEX_TEXTURE, // BGRA user texture
+        VERTEX_SDF_BOX,      // rounded box, with sdfShapes
+        VERTEX_SDF_TRIANGLE, // isosceles triangle, with sdfShapes
+    };
+
+    // Interleaved vertex: position in pixels, UV in 1/65535 units and colour
+    // as normalized RGBA8, so UVs are clamped to [0, 1]. SDF shapes store
+    // their local position in u, v instead, as 1/8 px offset by 32768, and
+    // their half extents and corner radius in shape, in 1/8 px.
+    struct Vertex
+    {
+        float x, y;
+        uint16_t u, v;
+        uint32_t col;
+        uint8_t mode;
+        uint8_t clip;   // 1 + index into the draw call's clip set, or 0
+        int16_t shape[3];
+    };
+    static_assert(sizeof(Vertex) == 24, "Vertex must stay 24 bytes");
+
+    // A run of indices in the frame's stream drawn with one user texture,
+    // clip set and scissor. The scissor is only used for damage rects.
+    struct DrawCall
+    {
+        GLuint texture = 0;
+        uint32_t clipSet = 0;
+        bool scissor = false;
+        GLint clip[4] = {0, 0, 0, 0};
+        uint32_t first = 0;
+        uint32_t count = 0;
+    };
+
+    // Where tessellation appends vertices and indices: a ring region, which
+    // has a fixed capacity, or a pair of vectors grown as needed.
+    struct StreamTarget
+    {
+        Vertex* vertices = nullptr;
+        uint32_t* indices = nullptr;
+        uint32_t vertexCount = 0;
+        uint32_t indexCount = 0;
+        uint32_t vertexCapacity = 0;
+        uint32_t indexCapacity = 0;
+        std::vector<Vertex>* vertexStore = nullptr;
+        std::vector<uint32_t>* indexStore = nullptr;
+    };
+
+    // Layout of GL's DrawArraysIndirectCommand.
+    struct IndirectDraw
+    {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t first;
+        uint32_t baseInstance;
+    };
+
+    // A glyph of a text command drawn by vertex pulling: the pen x it is
+    // placed at and its character.
+    struct PulledGlyph
+    {
+        float x;
+        uint32_t c;
+    };
+
+    // Cached shapes; the triangles are named after the way the collapse
+    // arrows point on screen, where y grows upwards.
+    enum TessShape : uint8_t
+    {
+        TESS_NONE,
+        TESS_ROUNDED_RECT,
+        TESS_TRIANGLE_RIGHT,
+        TESS_TRIANGLE_DOWN,
+    };
+
+    // A shape tessellated with its top left corner at the origin, ready to
+    // be translated into the stream. Colours are masks: inner vertices
+    // keep the shape's colour, the fringe only its RGB.
+    struct TessCacheEntry
+    {
+        TessShape shape = TESS_NONE;
+        float w = 0, h = 0, r = 0, fth = 0;
+        bool msaa = false;
+        uint64_t lastUse = 0;
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices; // relative to the first vertex
+    };
+
     struct RenderState
     {
         stbtt_bakedchar cdata[96]; // ASCII 32..126 is 95 glyphs
+        uint16_t glyphUV[96][4];   // cdata's atlas rect as normalized uint16
+        float fontAscent = 0;
+        float fontDescent = 0;
+        float fontMinXOff = 0; // leftmost glyph offset from the pen
         GLuint ftex = 0;
-        GLuint whitetex = 0;
         GLuint vao = 0;
-        GLuint vbos[3] = {0, 0, 0};
+        GLuint vbo = 0;
+        GLuint ibo = 0;
         GLuint program = 0;
-        GLuint font_program = 0;
         GLuint programViewportLocation = 0;
+        GLuint programFontTextureLocation = 0;
         GLuint programTextureLocation = 0;
-        GLuint font_programViewportLocation = 0;
-        GLuint font_programTextureLocation = 0;
+        GLuint programClipsLocation = 0;
 
         float tempCoords[TEMP_COORD_COUNT*2];
         float tempNormals[TEMP_COORD_COUNT*2];
-        float tempVertices[TEMP_COORD_COUNT * 12 + (TEMP_COORD_COUNT - 2) * 6];
-        float tempTextureCoords[TEMP_COORD_COUNT * 12 + (TEMP_COORD_COUNT - 2) * 6];
-        float tempColors[TEMP_COORD_COUNT * 24 + (TEMP_COORD_COUNT - 2) * 12];
-        float circleVerts[CIRCLE_VERTS*2];
+        float circleVerts[CIRCLE_LEVELS][CIRCLE_MAX_VERTS*2]; // unit circles
+
+        // Draw order of the frame's commands, grouped by pipeline state.
+        // Layer l occupies order[layerOrder[l] .. layerOrder[l + 1]).
+        std::vector<uint32_t> order;
+        uint32_t layerOrder[LAYER_COUNT + 1];
+
+        // The whole frame tessellated into one vertex stream, uploaded once
+        // and drawn as few draw calls as state changes allow. next holds the
+        // state that vertices appended from now on are drawn with. vertices
+        // and indices back the stream when it is not written to the ring.
+        StreamTarget stream;
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<DrawCall> draws;
+        DrawCall next;
+        // Clip rects of the frame's scissor commands as x0, y0, x1, y1,
+        // uploaded MAX_CLIPS at a time as the draw call's clip set.
+        std::vector<float> clips;
+        uint8_t nextClip = 0;
+        // Hash and size of the queue the stream was built from, and the
+        // render modes it was built in, to reuse it for unchanged frames.
+        bool streamValid = false;
+        bool streamPulled = false; // built by the vertex pulling path
+        bool streamSdf = false;
+        bool streamMsaa = false;
+        uint64_t streamHash = 0;
+        size_t streamCommands = 0;
+
+        // With GL_ARB_buffer_storage the stream is tessellated straight into
+        // one region of a persistently mapped ring, each region holding a
+        // frame's vertices followed by its indices and guarded by a fence
+        // until the GPU is done with it. A frame that outgrows its region
+        // spills into vertices and indices, and is tessellated again once
+        // the ring has grown. Otherwise the stream is uploaded to vbo and
+        // ibo.
+        bool useRing = false;
+        bool streamSpilled = false;
+        GLuint ring = 0;
+        char* ringData = nullptr;
+        size_t ringRegionSize = 0;
+        size_t ringVertexSize = 0; // bytes of a region holding vertices
+        unsigned ringRegion = 0;
+        GLsync ringFences[RING_REGIONS] = {};
+        // Byte offsets of the current stream in the bound buffers.
+        size_t vertexOffset = 0;
+        size_t indexOffset = 0;
+
+        // With GL 4.3 and vertexPulling the frame's commands and arena are
+        // uploaded as they are to shader storage buffers and expanded into
+        // quads by pullProgram's vertex shader. Each drawn command is one
+        // indirect draw whose instance attribute is its index in commands;
+        // draws holds the runs of indirect draws sharing a texture and
+        // scissor.
+        GLuint pullProgram = 0;
+        GLuint pullViewportLocation = 0;
+        GLuint pullVao = 0;
+        GLuint commandBuffer = 0;
+        GLuint arenaBuffer = 0;
+        GLuint glyphBuffer = 0;     // cdata as atlas rect, offset and advance
+        GLuint instanceBuffer = 0;  // 0, 1, 2, ... as command indices
+        GLuint indirectBuffer = 0;
+        GLuint textBuffer = 0;      // pulledGlyphs
+        size_t instanceCount = 0;
+        std::vector<IndirectDraw> indirect;
+        std::vector<PulledGlyph> pulledGlyphs;
+
+        // Set associative cache of tessellated shapes, evicting the least
+        // recently used way of a set.
+        TessCacheEntry tessCache[TESS_CACHE_SETS * TESS_CACHE_WAYS];
+        uint64_t tessCacheClock = 0;
+
+        GLStateCache gl;
+        float viewportSize[2] = {0, 0}; // last Viewport uniform
+        std::vector<RenderBatch> batches;
+        std::vector<uint32_t> cmdBatch;
     };
 
     struct ImguiRenderGL3
     {
         bool init(const std::string& fontpath);
         void destroy();
-        void draw(Imgui& imgui, int width, int height);
+        // With damageOnly only the frame's damage rects are redrawn, on top
+        // of a back buffer that still holds the previous frame and where the
+        // application has restored its own content under those rects.
+        void draw(const Imgui& imgui, int width, int height, bool damageOnly = false);
 
         ~ImguiRenderGL3()
         {
@@ -70,18 +315,62 @@ namespace imgui
         ImguiRenderGL3(ImguiRenderGL3&&) noexcept;
         ImguiRenderGL3& operator=(ImguiRenderGL3&&) noexcept;
 
+        RenderStats stats; // of the last draw()
+
+        // Draw rects, rounded rects, lines and triangles as one quad each,
+        // shaded from a signed distance function, instead of tessellating
+        // them with an AA fringe.
+        bool sdfShapes = false;
+
+        // Expand the commands into vertices on the GPU instead of on the
+        // CPU, where GL 4.3 is available. Shapes are drawn as with
+        // sdfShapes. Damage only draws still tessellate on the CPU.
+        bool vertexPulling = false;
+
+        // The target framebuffer is multisampled: tessellated shapes are
+        // drawn without their AA fringe, leaving edges to the hardware.
+        bool msaa = false;
+
     private:
         bool initialized = false;
         RenderState state;
 
         void drawTexturedPolygon(const float* coords, unsigned numCoords, float r, unsigned int col, GLuint tex, float tx0, float ty0, float tx1, float ty1);
+        void drawFringelessPolygon(const float* coords, unsigned numCoords, uint32_t col, uint8_t mode, GLuint tex, float tx0, float ty0, float tx1, float ty1);
         void drawPolygon(const float* coords, unsigned numCoords, float r, uint32_t col);
         void drawRect(float x, float y, float w, float h, float fth, uint32_t col);
         void drawTexturedRect(float x, float y, float w, float h, uint32_t texture, uint32_t col, float tx0, float ty0, float tx1, float ty1);
         void drawRoundedRect(float x, float y, float w, float h, float r, float fth, uint32_t col);
         void drawLine(float x0, float y0, float x1, float y1, float r, float fth, uint32_t col);
+        void drawCachedShape(TessShape shape, float x, float y, float w, float h, float r, float fth, uint32_t col);
+        void tessellateShape(TessCacheEntry& e, TessShape shape, float w, float h, float r, float fth);
+        void drawShapeQuad(float ox, float oy, float dx, float dy, const float* local, float hx, float hy, float r, uint8_t mode, uint32_t col);
+        void drawShape(const gfxCmd& cmd);
         void getBakedQuad(stbtt_bakedchar *chardata, int pw, int ph, int char_index, float *xpos, float *ypos, stbtt_aligned_quad *q, float scale);
-        void drawText(float x, float y, const std::string& text, int align, uint32_t col, float pointSize);
+        void drawText(float x, float y, const char* text, unsigned length, int align, uint32_t col, float pointSize, const gfxBox* clip);
+        uint32_t allocVertices(unsigned count);
+        uint32_t* allocIndices(unsigned count);
+        void freeTail(unsigned vertexCount, unsigned indexCount);
+        void growStream();
+        void addClip(const gfxBox& b);
+        void resetScissor(const gfxDamageRect* damage);
+        void tessellateCommands(const gfxCmdQueue& queue, const gfxDamageRect* damage);
+        bool createRing(size_t vertexSize, size_t indexSize);
+        void destroyRing();
+        void waitRegion(unsigned region);
+        void beginStream();
+        bool uploadStream();
+        void setVertexFormat(GLuint buffer, size_t offset);
+        void drawStream();
+        void drawTessellated(const gfxCmdQueue& queue, int width, int height, bool damageOnly);
+        bool initPulling(const char* fsBody);
+        void layoutPulledText(const gfxText& text, const char* arena, const gfxBox* clip);
+        void buildPulledDraws(const gfxCmdQueue& queue);
+        void uploadPulled(const gfxCmdQueue& queue);
+        void drawPulled(const gfxCmdQueue& queue, int width, int height);
+        gfxBox commandBounds(const gfxCmd& cmd, const char* arena);
+        void sortSegment(const gfxCmd* cmds, const char* arena, uint32_t begin, uint32_t end);
+        void sortCommands(const gfxCmdQueue& queue);
     };
 }
 
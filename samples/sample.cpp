@@ -59,7 +59,9 @@ int main (int argc, char* argv[])
     glfwSwapInterval(1);
 
     // Init UI
-    if (!imguiRenderGLInit("DroidSans.ttf"))
+    imgui::Imgui gui;
+    imgui::ImguiRenderGL3 renderer;
+    if (!renderer.init("DroidSans.ttf"))
     {
         std::cerr << "Could not init GUI renderer" << std::endl;
         glfwDestroyWindow(window);
@@ -101,11 +103,11 @@ int main (int argc, char* argv[])
     {
         glfwPollEvents();
 
+        int lastWidth = width;
+        int lastHeight = height;
         glfwGetFramebufferSize(window, &width, &height);
         glViewport(0, 0, width, height);
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
         // Mouse states
         int mScroll = (int)(glfwScroll - currentGlfwScroll);
         glfwScroll = currentGlfwScroll;
@@ -122,95 +124,112 @@ int main (int argc, char* argv[])
         int toggle = 0;
         if (leftButton == GLFW_PRESS)
         {
-            mouseButton |= IMGUI_MBUT_LEFT;
+            mouseButton |= imgui::MBUT_LEFT;
         }
 
-        imguiBeginFrame(mouseX, mouseY, mouseButton, mScroll);
+        gui.beginFrame(mouseX, mouseY, (imgui::MouseButton)mouseButton, mScroll);
 
-        imguiBeginScrollArea("Scroll area", 10, 10, width / 5, height - 20, &scrollArea1);
-        imguiSeparatorLine();
-        imguiSeparator();
+        gui.beginScrollArea("Scroll area", 10, 10, width / 5, height - 20, scrollArea1);
+        gui.separatorLine();
+        gui.separator();
 
-        imguiButton("Button");
-        imguiButton("Disabled button", false);
-        imguiItem("Item");
-        imguiItem("Disabled item", false);
-        toggle = imguiCheck("Checkbox", checked1);
+        gui.button("Button");
+        gui.button("Disabled button", false);
+        gui.item("Item");
+        gui.item("Disabled item", false);
+        toggle = gui.check("Checkbox", checked1);
         if (toggle)
         {
             checked1 = !checked1;
         }
 
-        toggle = imguiCheck("Disabled checkbox", checked2, false);
+        toggle = gui.check("Disabled checkbox", checked2, false);
         if (toggle)
         {
             checked2 = !checked2;
         }
 
-        toggle = imguiCollapse("Collapse", "subtext", checked3);
+        toggle = gui.collapse("Collapse", "subtext", checked3);
         if (checked3)
         {
-            imguiIndent();
-            imguiLabel("Collapsible element");
-            imguiUnindent();
+            gui.indent();
+            gui.label("Collapsible element");
+            gui.unindent();
         }
         if (toggle)
         {
             checked3 = !checked3;
         }
 
-        toggle = imguiCollapse("Disabled collapse", "subtext", checked4, false);
+        toggle = gui.collapse("Disabled collapse", "subtext", checked4, false);
         if (toggle)
         {
             checked4 = !checked4;
         }
 
-        imguiLabel("Label");
-        imguiValue("Value");
-        imguiSlider("Slider", &value1, 0.f, 100.f, 1.f);
-        imguiSlider("Disabled slider", &value2, 0.f, 100.f, 1.f, false);
-        imguiIndent();
-        imguiLabel("Indented");
-        imguiUnindent();
-        imguiLabel("Unindented");
-
-        imguiEndScrollArea();
-
-        imguiBeginScrollArea("Scroll area", 20 + width / 5, 100, width / 5, 510, &scrollArea2);
-        imguiSeparatorLine();
-        imguiSeparator();
-        for (int i = 0; i < 100; ++i)
+        gui.label("Label");
+        gui.value("Value");
+        gui.slider("Slider", value1, 0.f, 100.f, 1.f);
+        gui.slider("Disabled slider", value2, 0.f, 100.f, 1.f, false);
+        gui.indent();
+        gui.label("Indented");
+        gui.unindent();
+        gui.label("Unindented");
+
+        gui.endScrollArea();
+
+        gui.beginScrollArea("Scroll area", 20 + width / 5, 100, width / 5, 510, scrollArea2);
+        gui.separatorLine();
+        gui.separator();
+        // Only the visible labels (16 units high each) are submitted.
+        int first, last;
+        gui.beginClipper(100, 16, first, last);
+        for (int i = first; i < last; ++i)
         {
-            imguiLabel("A wall of text");
+            gui.label("A wall of text");
         }
+        gui.endClipper();
+
+        gui.endScrollArea();
+
+        gui.drawText(30 + width / 5 * 2,       height - 20, imgui::ALIGN_LEFT,   "Free text", imgui::RGBA(32, 192,  32, 192));
+        gui.drawText(30 + width / 5 * 2 + 100, height - 40, imgui::ALIGN_RIGHT,  "Free text", imgui::RGBA(32,  32, 192, 192));
+        gui.drawText(30 + width / 5 * 2 + 50,  height - 60, imgui::ALIGN_CENTER, "Free text", imgui::RGBA(192, 32,  32, 192));
 
-        imguiEndScrollArea();
-        imguiEndFrame();
+        gui.drawLine(30 + width / 5 * 2, height - 80,  30 + width / 5 * 2 + 100, height - 60,  1.f, imgui::RGBA(32, 192,  32, 192));
+        gui.drawLine(30 + width / 5 * 2, height - 100, 30 + width / 5 * 2 + 100, height - 80,  2.f, imgui::RGBA(32,  32, 192, 192));
+        gui.drawLine(30 + width / 5 * 2, height - 120, 30 + width / 5 * 2 + 100, height - 100, 3.f, imgui::RGBA(192, 32,  32, 192));
 
-        imguiDrawText(30 + width / 5 * 2,       height - 20, IMGUI_ALIGN_LEFT,   "Free text", imguiRGBA(32, 192,  32, 192));
-        imguiDrawText(30 + width / 5 * 2 + 100, height - 40, IMGUI_ALIGN_RIGHT,  "Free text", imguiRGBA(32,  32, 192, 192));
-        imguiDrawText(30 + width / 5 * 2 + 50,  height - 60, IMGUI_ALIGN_CENTER, "Free text", imguiRGBA(192, 32,  32, 192));
+        gui.drawRoundedRect(30 + width / 5 * 2, height - 240, 100, 100, 5.f,  imgui::RGBA(32, 192,  32, 192));
+        gui.drawRoundedRect(30 + width / 5 * 2, height - 350, 100, 100, 10.f, imgui::RGBA(32,  32, 192, 192));
+        gui.drawRoundedRect(30 + width / 5 * 2, height - 470, 100, 100, 20.f, imgui::RGBA(192, 32,  32, 192));
 
-        imguiDrawLine(30 + width / 5 * 2, height - 80,  30 + width / 5 * 2 + 100, height - 60,  1.f, imguiRGBA(32, 192,  32, 192));
-        imguiDrawLine(30 + width / 5 * 2, height - 100, 30 + width / 5 * 2 + 100, height - 80,  2.f, imguiRGBA(32,  32, 192, 192));
-        imguiDrawLine(30 + width / 5 * 2, height - 120, 30 + width / 5 * 2 + 100, height - 100, 3.f, imguiRGBA(192, 32,  32, 192));
+        gui.drawRect(30 + width / 5 * 2, height - 590, 100, 100, imgui::RGBA(32, 192, 32, 192));
+        gui.drawRect(30 + width / 5 * 2, height - 710, 100, 100, imgui::RGBA(32, 32, 192, 192));
+        gui.drawRect(30 + width / 5 * 2, height - 830, 100, 100, imgui::RGBA(192, 32, 32,192));
 
-        imguiDrawRoundedRect(30 + width / 5 * 2, height - 240, 100, 100, 5.f,  imguiRGBA(32, 192,  32, 192));
-        imguiDrawRoundedRect(30 + width / 5 * 2, height - 350, 100, 100, 10.f, imguiRGBA(32,  32, 192, 192));
-        imguiDrawRoundedRect(30 + width / 5 * 2, height - 470, 100, 100, 20.f, imguiRGBA(192, 32,  32, 192));
+        // Everything drawn up to here is handed over to the renderer.
+        gui.endFrame();
 
-        imguiDrawRect(30 + width / 5 * 2, height - 590, 100, 100, imguiRGBA(32, 192, 32, 192));
-        imguiDrawRect(30 + width / 5 * 2, height - 710, 100, 100, imguiRGBA(32, 32, 192, 192));
-        imguiDrawRect(30 + width / 5 * 2, height - 830, 100, 100, imguiRGBA(192, 32, 32,192));
+        // The front buffer already shows this frame, wait for input instead
+        // of drawing and swapping it again.
+        if (gui.frameQueue.unchanged && width == lastWidth && height == lastHeight)
+        {
+            glfwWaitEvents();
+            continue;
+        }
 
-        imguiRenderGLDraw(width, height);
+        gui.optimizeGfxCmdQueue();
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderer.draw(gui, width, height);
 
         // Swap buffers
         glfwSwapBuffers(window);
     }
 
     // Clean UI
-    imguiRenderGLDestroy();
+    renderer.destroy();
 
     // Close OpenGL window and terminate GLFW
     glfwTerminate();
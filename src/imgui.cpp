@@ -22,17 +22,61 @@
 
 #include <cstdio>
 #include <cstring>
-#include <string>
+#include <string_view>
 #include <cmath>
+#include <algorithm>
+#include <utility>
 
 #include "imgui.h"
 
 using namespace imgui;
 
+// Cheap rolling hash of everything recorded in a frame, used to tell
+// whether a frame differs from the one before it.
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (; size >= 8; size -= 8, bytes += 8)
+    {
+        uint64_t w;
+        memcpy(&w, bytes, 8);
+        hash = (hash ^ (w * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 31;
+    }
+    for (; size > 0; --size, ++bytes)
+    {
+        hash = (hash ^ *bytes) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
 void Imgui::resetGfxCmdQueue()
 {
     renderQueue.clear();
 }
+uint32_t Imgui::addGfxData(const void* data, uint32_t size, uint32_t align)
+{
+    // data may be null when size is 0, which memcpy does not allow.
+    if (size == 0)
+    {
+        return 0;
+    }
+    std::vector<char>& arena = renderQueue.arena;
+    uint32_t offset = (uint32_t)arena.size();
+    offset = (offset + align - 1) & ~(align - 1);
+    arena.resize(offset + size);
+    memcpy(arena.data() + offset, data, size);
+    renderQueue.hash = hashBytes(renderQueue.hash, data, size);
+    return offset;
+}
+// The hash covers the raw command bytes, union padding included, so the
+// builders below memset commands rather than brace-initialising them.
+void Imgui::addGfxCmd(const gfxCmd& cmd)
+{
+    renderQueue.layers[state.layer].push_back(cmd);
+    renderQueue.hash = hashBytes(renderQueue.hash, &cmd, sizeof(cmd));
+    renderQueue.hash = hashBytes(renderQueue.hash, &state.layer, sizeof(state.layer));
+}
 bool Imgui::anyActive()
 {
     return state.active != 0;
@@ -51,6 +95,13 @@ bool Imgui::inRect(int x, int y, int w, int h, bool checkScroll)
            state.mx >= x && state.mx <= x + w &&
            state.my >= y && state.my <= y + h;
 }
+// Widgets entirely outside the current scroll area are laid out and keep
+// their input logic, but record no commands.
+bool Imgui::isClipped(float y, float h)
+{
+    return state.clipToScroll &&
+           (y + h < state.scrollBottom || y > state.scrollTop);
+}
 void Imgui::clearInput()
 {
     state.leftPressed = false;
@@ -143,12 +194,24 @@ void Imgui::beginFrame(int mx, int my, MouseButton mbut, int scroll)
     state.areaId = 1;
     state.widgetId = 1;
 
+    state.layer = LAYER_MAIN;
+
     resetGfxCmdQueue();
 }
 
 void Imgui::endFrame()
 {
     clearInput();
+
+    // Sizes are not compared: optimizeGfxCmdQueue() may have shrunk the
+    // previous frame's commands after they were hashed.
+    renderQueue.unchanged = renderQueue.hash == frameQueue.hash &&
+                            renderQueue.arena.size() == frameQueue.arena.size();
+    if (trackDamage)
+    {
+        updateDamage();
+    }
+    std::swap(renderQueue, frameQueue);
 }
 
 static const float BUTTON_HEIGHT       = 16;
@@ -161,7 +224,7 @@ static const float SCROLL_AREA_PADDING = 3;
 static const float INDENT_SIZE         = 16;
 static const float AREA_HEADER         = 20;
 
-bool Imgui::beginScrollArea(const std::string& name, int x, int y, int w, int h, int& scroll)
+bool Imgui::beginScrollArea(std::string_view name, int x, int y, int w, int h, int& scroll)
 {
     int header = name.length() != 0 ? AREA_HEADER: SCROLL_AREA_PADDING + 2;
 
@@ -199,13 +262,19 @@ bool Imgui::beginScrollArea(const std::string& name, int x, int y, int w, int h,
                      y + SCROLL_AREA_PADDING,
                      w - SCROLL_AREA_PADDING * 2,
                      h - header - SCROLL_AREA_PADDING);
+    state.clipToScroll = true;
+    state.scrollLayer = state.layer;
 
     return state.insideScrollArea;
 }
 void Imgui::endScrollArea()
 {
-    // Disable scissoring.
+    // Disable scissoring in the layer the area was begun in.
+    const DrawLayer layer = state.layer;
+    state.layer = state.scrollLayer;
     addGfxCmdScissor(-1,-1,-1,-1);
+    state.layer = layer;
+    state.clipToScroll = false;
 
     // Draw scroll bar
     int x = state.scrollRight+SCROLL_AREA_PADDING;
@@ -289,7 +358,7 @@ void Imgui::endScrollArea()
     }
     state.insideCurrentScroll = false;
 }
-bool Imgui::button(const std::string& text, bool enabled)
+bool Imgui::button(std::string_view text, bool enabled)
 {
     state.widgetId++;
     uint32_t id = (state.areaId<<16) | state.widgetId;
@@ -302,6 +371,10 @@ bool Imgui::button(const std::string& text, bool enabled)
 
     bool over = enabled && inRect(x, y, w, h);
     bool res = buttonLogic(id, over);
+    if (isClipped(y, h))
+    {
+        return res;
+    }
 
     addGfxCmdRoundedRect((float)x, (float)y, (float)w, (float)h, (float)BUTTON_HEIGHT/2-1, RGBA(128,128,128, isActive(id)?196:96));
     if (enabled)
@@ -315,7 +388,7 @@ bool Imgui::button(const std::string& text, bool enabled)
 
     return res;
 }
-bool Imgui::item(const std::string& text, bool enabled)
+bool Imgui::item(std::string_view text, bool enabled)
 {
     state.widgetId++;
     uint32_t id = (state.areaId<<16) | state.widgetId;
@@ -328,6 +401,10 @@ bool Imgui::item(const std::string& text, bool enabled)
 
     bool over = enabled && inRect(x, y, w, h);
     bool res = buttonLogic(id, over);
+    if (isClipped(y, h))
+    {
+        return res;
+    }
 
     if (isHot(id))
     {
@@ -345,7 +422,7 @@ bool Imgui::item(const std::string& text, bool enabled)
 
     return res;
 }
-bool Imgui::check(const std::string& text, bool checked, bool enabled)
+bool Imgui::check(std::string_view text, bool checked, bool enabled)
 {
     state.widgetId++;
     uint32_t id = (state.areaId<<16) | state.widgetId;
@@ -358,6 +435,10 @@ bool Imgui::check(const std::string& text, bool checked, bool enabled)
 
     bool over = enabled && inRect(x, y, w, h);
     bool res = buttonLogic(id, over);
+    if (isClipped(y, h))
+    {
+        return res;
+    }
 
     const float cx = x+w-BUTTON_HEIGHT/2-CHECK_SIZE/2;
     const float cy = y+BUTTON_HEIGHT/2-CHECK_SIZE/2;
@@ -385,7 +466,7 @@ bool Imgui::check(const std::string& text, bool checked, bool enabled)
 
     return res;
 }
-bool Imgui::collapse(const std::string& text, const std::string& subtext, bool checked, bool enabled)
+bool Imgui::collapse(std::string_view text, std::string_view subtext, bool checked, bool enabled)
 {
     state.widgetId++;
     uint32_t id = (state.areaId << 16) | state.widgetId;
@@ -401,6 +482,10 @@ bool Imgui::collapse(const std::string& text, const std::string& subtext, bool c
 
     bool over = enabled && inRect(x, y, w, h);
     bool res = buttonLogic(id, over);
+    if (isClipped(y, h))
+    {
+        return res;
+    }
 
     if (checked)
     {
@@ -434,7 +519,7 @@ bool Imgui::collapse(const std::string& text, const std::string& subtext, bool c
 
     return res;
 }
-void Imgui::label(const std::string& text, TextAlign align, bool dontMove, float scale)
+void Imgui::label(std::string_view text, TextAlign align, bool dontMove, float scale)
 {
     float x = state.widgetX;
     float y = state.widgetY - BUTTON_HEIGHT * scale;
@@ -442,6 +527,10 @@ void Imgui::label(const std::string& text, TextAlign align, bool dontMove, float
     {
         state.widgetY -= BUTTON_HEIGHT * scale;
     }
+    if (isClipped(y, BUTTON_HEIGHT * scale))
+    {
+        return;
+    }
     if (align == ALIGN_CENTER)
     {
         x += state.widgetW / 2;
@@ -454,12 +543,16 @@ void Imgui::label(const std::string& text, TextAlign align, bool dontMove, float
                   text, RGBA(255,255,255,255),
                   8.f * scale);
 }
-void Imgui::value(const std::string& text, TextAlign align, float scale)
+void Imgui::value(std::string_view text, TextAlign align, float scale)
 {
     float x = state.widgetX;
     const float y = state.widgetY - BUTTON_HEIGHT * scale;
     const float w = state.widgetW;
     state.widgetY -= BUTTON_HEIGHT * scale;
+    if (isClipped(y, BUTTON_HEIGHT * scale))
+    {
+        return;
+    }
 
     if (align == ALIGN_CENTER)
     {
@@ -474,7 +567,7 @@ void Imgui::value(const std::string& text, TextAlign align, float scale)
                   align, text, RGBA(255,255,255,200),
                   8.f * scale);
 }
-void Imgui::labelledValue(const std::string& label, const std::string& value, float scale)
+void Imgui::labelledValue(std::string_view label, std::string_view value, float scale)
 {
     this->label(label, ALIGN_LEFT, true, scale);
     this->value(value, ALIGN_RIGHT, scale);
@@ -487,7 +580,40 @@ void Imgui::renderPort(float x, float y, float w)
     state.widgetW = w;
 }
 
-bool Imgui::slider(const std::string& text, float& val, float vmin, float vmax, float vinc, bool enabled, float scale)
+void Imgui::setLayer(DrawLayer layer)
+{
+    state.layer = layer;
+}
+
+void Imgui::beginClipper(int count, float rowHeight, int& first, int& last, int idsPerRow)
+{
+    const float top = state.widgetY;
+    state.clipperTop = top;
+    state.clipperHeight = count * rowHeight;
+    state.clipperId = state.widgetId;
+    state.clipperRowIds = (uint32_t)idsPerRow;
+    state.clipperCount = count;
+
+    first = 0;
+    last = count;
+    if (state.clipToScroll && rowHeight > 0)
+    {
+        // Row i spans [top - (i+1)*rowHeight, top - i*rowHeight].
+        first = (int)ceilf((top - state.scrollTop) / rowHeight - 1);
+        last = (int)floorf((top - state.scrollBottom) / rowHeight) + 1;
+        first = first < 0 ? 0 : first > count ? count : first;
+        last = last < first ? first : last > count ? count : last;
+    }
+    state.widgetY = top - first * rowHeight;
+    state.widgetId += first * state.clipperRowIds;
+}
+void Imgui::endClipper()
+{
+    state.widgetY = state.clipperTop - state.clipperHeight;
+    state.widgetId = state.clipperId + state.clipperCount * state.clipperRowIds;
+}
+
+bool Imgui::slider(std::string_view text, float& val, float vmin, float vmax, float vinc, bool enabled, float scale)
 {
     state.widgetId++;
     uint32_t id = (state.areaId << 16) | state.widgetId;
@@ -498,8 +624,6 @@ bool Imgui::slider(const std::string& text, float& val, float vmin, float vmax,
     float h = SLIDER_HEIGHT * scale;
     state.widgetY -= (SLIDER_HEIGHT + DEFAULT_SPACING) * scale;
 
-    addGfxCmdRoundedRect((float)x, (float)y, (float)w, (float)h, 4.0f * scale, RGBA(255,255,255,32));
-
     const int range = w - SLIDER_MARKER_WIDTH * scale;
 
     float u = (val - vmin) / (vmax-vmin);
@@ -529,6 +653,13 @@ bool Imgui::slider(const std::string& text, float& val, float vmin, float vmax,
         }
     }
 
+    if (isClipped(y, h))
+    {
+        return valChanged;
+    }
+
+    addGfxCmdRoundedRect((float)x, (float)y, (float)w, (float)h, 4.0f * scale, RGBA(255,255,255,32));
+
     if (isActive(id))
     {
         addGfxCmdRoundedRect((float)(x + m),
@@ -608,10 +739,14 @@ void Imgui::separatorLine()
     float w = state.widgetW;
     float h = 1;
     state.widgetY -= DEFAULT_SPACING * 4;
+    if (isClipped(y, h))
+    {
+        return;
+    }
 
     addGfxCmdRect((float)x, (float)y, (float)w, (float)h, RGBA(255,255,255,32));
 }
-void Imgui::drawText(int x, int y, TextAlign align, const std::string& text, uint32_t color, float pointSize)
+void Imgui::drawText(int x, int y, TextAlign align, std::string_view text, uint32_t color, float pointSize)
 {
     addGfxCmdText(x, y, align, text, color, pointSize);
 }
@@ -635,6 +770,7 @@ void Imgui::drawTexturedRect(float x, float y, float w, float h, uint32_t color,
 void Imgui:: addGfxCmdScissor(int x, int y, int w, int h)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_SCISSOR;
     cmd.flags = x < 0 ? 0 : 1;      // on/off flag.
     cmd.col = 0;
@@ -642,11 +778,12 @@ void Imgui:: addGfxCmdScissor(int x, int y, int w, int h)
     cmd.rect.y = y;
     cmd.rect.w = w;
     cmd.rect.h = h;
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
 }
 void Imgui:: addGfxCmdRect(float x, float y, float w, float h, uint32_t color)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_RECT;
     cmd.flags = 0;
     cmd.col = color;
@@ -655,29 +792,29 @@ void Imgui:: addGfxCmdRect(float x, float y, float w, float h, uint32_t color)
     cmd.rect.w = (w*8.0f);
     cmd.rect.h = (h*8.0f);
     cmd.rect.r = 0;
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
 }
 
 void Imgui:: addGfxCmdTexturedRect(float x, float y, float w, float h, uint32_t color, uint32_t texture, float tx0, float ty0, float tx1, float ty1)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    const float texCoords[4] = {tx0, ty0, tx1, ty1};
     cmd.type = GFXCMD_TEXTURED_RECT;
     cmd.flags = 0;
     cmd.col = color;
-    cmd.rect.x = (x*8.0f);
-    cmd.rect.y = (y*8.0f);
-    cmd.rect.w = (w*8.0f);
-    cmd.rect.h = (h*8.0f);
+    cmd.texturedRect.x = (x*8.0f);
+    cmd.texturedRect.y = (y*8.0f);
+    cmd.texturedRect.w = (w*8.0f);
+    cmd.texturedRect.h = (h*8.0f);
     cmd.texturedRect.texture = texture;
-    cmd.texturedRect.tx0 = tx0;
-    cmd.texturedRect.ty0 = ty0;
-    cmd.texturedRect.tx1 = tx1;
-    cmd.texturedRect.ty1 = ty1;
-    renderQueue.push_back(cmd);
+    cmd.texturedRect.texCoords = addGfxData(texCoords, sizeof(texCoords), sizeof(float));
+    addGfxCmd(cmd);
 }
 void Imgui:: addGfxCmdLine(float x0, float y0, float x1, float y1, float r, uint32_t color)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_LINE;
     cmd.flags = 0;
     cmd.col = color;
@@ -686,11 +823,12 @@ void Imgui:: addGfxCmdLine(float x0, float y0, float x1, float y1, float r, uint
     cmd.line.x1 = (x1*8.0f);
     cmd.line.y1 = (y1*8.0f);
     cmd.line.r = (r*8.0f);
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
 }
 void Imgui:: addGfxCmdRoundedRect(float x, float y, float w, float h, float r, uint32_t color)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_RECT;
     cmd.flags = 0;
     cmd.col = color;
@@ -699,11 +837,12 @@ void Imgui:: addGfxCmdRoundedRect(float x, float y, float w, float h, float r, u
     cmd.rect.w = (w*8.0f);
     cmd.rect.h = (h*8.0f);
     cmd.rect.r = (r*8.0f);
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
 }
 void Imgui:: addGfxCmdTriangle(int x, int y, int w, int h, int flags, uint32_t color)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_TRIANGLE;
     cmd.flags = (char)flags;
     cmd.col = color;
@@ -711,18 +850,349 @@ void Imgui:: addGfxCmdTriangle(int x, int y, int w, int h, int flags, uint32_t c
     cmd.rect.y = (y*8.0f);
     cmd.rect.w = (w*8.0f);
     cmd.rect.h = (h*8.0f);
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
 }
-void Imgui:: addGfxCmdText(int x, int y, TextAlign align, const std::string& text, uint32_t color, float pointSize)
+void Imgui:: addGfxCmdText(int x, int y, TextAlign align, std::string_view text, uint32_t color, float pointSize)
 {
     gfxCmd cmd;
+    memset(&cmd, 0, sizeof(cmd));
     cmd.type = GFXCMD_TEXT;
     cmd.flags = 0;
     cmd.col = color;
     cmd.text.x = x;
     cmd.text.y = y;
     cmd.text.align = align;
-    cmd.text.text = text;
+    cmd.text.offset = addGfxData(text.data(), (uint32_t)text.length());
+    cmd.text.length = (uint32_t)text.length();
     cmd.text.pointSize = (pointSize * 100);
-    renderQueue.push_back(cmd);
+    addGfxCmd(cmd);
+}
+
+gfxBox imgui::gfxCmdBounds(const gfxCmd& cmd, const char* arena)
+{
+    const float s = 1.0f/8.0f;
+    gfxBox b;
+    if (cmd.type == GFXCMD_LINE)
+    {
+        const float r = cmd.line.r*s;
+        b.x0 = std::min(cmd.line.x0, cmd.line.x1)*s - r;
+        b.y0 = std::min(cmd.line.y0, cmd.line.y1)*s - r;
+        b.x1 = std::max(cmd.line.x0, cmd.line.x1)*s + r;
+        b.y1 = std::max(cmd.line.y0, cmd.line.y1)*s + r;
+    }
+    else if (cmd.type == GFXCMD_TEXT)
+    {
+        // The frontend has no font metrics: assume glyphs no wider than two
+        // point sizes, ascenders up to two and descenders up to one.
+        const float pointSize = cmd.text.pointSize / 100.f;
+        float w = cmd.text.length * pointSize * 2;
+        if (cmd.text.length && memchr(arena + cmd.text.offset, '\t', cmd.text.length))
+        {
+            w += 330 * pointSize / 8;
+        }
+        b.x0 = cmd.text.align == ALIGN_LEFT ? cmd.text.x :
+               cmd.text.align == ALIGN_CENTER ? cmd.text.x - w/2 : cmd.text.x - w;
+        b.x1 = b.x0 + w;
+        b.y0 = cmd.text.y - pointSize;
+        b.y1 = cmd.text.y + pointSize * 2;
+    }
+    else
+    {
+        b.x0 = cmd.rect.x*s;
+        b.y0 = cmd.rect.y*s;
+        b.x1 = (cmd.rect.x + cmd.rect.w)*s;
+        b.y1 = (cmd.rect.y + cmd.rect.h)*s;
+    }
+    // Antialiasing fringe.
+    b.x0 -= 1;
+    b.y0 -= 1;
+    b.x1 += 1;
+    b.y1 += 1;
+    return b;
+}
+
+static const unsigned MAX_DAMAGE_RECTS = 8;
+
+static bool overlaps(const gfxBox& a, const gfxBox& b)
+{
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+static gfxBox unite(const gfxBox& a, const gfxBox& b)
+{
+    return { std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1) };
+}
+static float area(const gfxBox& a)
+{
+    return (a.x1 - a.x0) * (a.y1 - a.y0);
+}
+
+// Keeps the damage list disjoint (a primitive redrawn under two
+// overlapping rects would be blended twice) and at most MAX_DAMAGE_RECTS
+// long by merging the pair that wastes the least area.
+static void addDamage(std::vector<gfxBox>& damage, gfxBox b)
+{
+    b.x0 = floorf(b.x0);
+    b.y0 = floorf(b.y0);
+    b.x1 = ceilf(b.x1);
+    b.y1 = ceilf(b.y1);
+    if (b.x0 >= b.x1 || b.y0 >= b.y1)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < damage.size(); )
+    {
+        if (overlaps(damage[i], b))
+        {
+            b = unite(b, damage[i]);
+            damage[i] = damage.back();
+            damage.pop_back();
+            i = 0;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    damage.push_back(b);
+
+    if (damage.size() > MAX_DAMAGE_RECTS)
+    {
+        size_t bi = 0, bj = 1;
+        float best = 1e30f;
+        for (size_t i = 0; i < damage.size(); ++i)
+        {
+            for (size_t j = i + 1; j < damage.size(); ++j)
+            {
+                float waste = area(unite(damage[i], damage[j])) - area(damage[i]) - area(damage[j]);
+                if (waste < best)
+                {
+                    best = waste;
+                    bi = i;
+                    bj = j;
+                }
+            }
+        }
+        gfxBox merged = unite(damage[bi], damage[bj]);
+        damage.erase(damage.begin() + bj);
+        damage.erase(damage.begin() + bi);
+        addDamage(damage, merged);
+    }
+}
+
+// Keys hash what a command draws (not where its payload sits in the arena),
+// the scissor it is drawn under and every earlier command of its layer that
+// it overlaps, so that reordering overlapping commands is seen as a change
+// too, even when other commands sit between them.
+static void updateKeys(gfxCmdQueue& queue)
+{
+    queue.keys.clear();
+
+    const char* arena = queue.arena.data();
+    for (unsigned layer = 0; layer < LAYER_COUNT; ++layer)
+    {
+        const size_t first = queue.keys.size();
+        bool scissor = false;
+        gfxBox clip = {0, 0, 0, 0};
+        for (const gfxCmd& cmd : queue.layers[layer])
+        {
+            if (cmd.type == GFXCMD_SCISSOR)
+            {
+                scissor = cmd.flags != 0;
+                clip = { cmd.rect.x, cmd.rect.y, cmd.rect.x + cmd.rect.w, cmd.rect.y + cmd.rect.h };
+                continue;
+            }
+
+            gfxBox b = gfxCmdBounds(cmd, arena);
+            if (scissor)
+            {
+                if (!overlaps(b, clip))
+                {
+                    continue;
+                }
+                b = { std::max(b.x0, clip.x0), std::max(b.y0, clip.y0), std::min(b.x1, clip.x1), std::min(b.y1, clip.y1) };
+            }
+
+            gfxCmd c = cmd;
+            uint64_t h = 0;
+            if (c.type == GFXCMD_TEXT)
+            {
+                h = hashBytes(h, arena + c.text.offset, c.text.length);
+                c.text.offset = 0;
+            }
+            else if (c.type == GFXCMD_TEXTURED_RECT)
+            {
+                h = hashBytes(h, arena + c.texturedRect.texCoords, 4 * sizeof(float));
+                c.texturedRect.texCoords = 0;
+            }
+            h = hashBytes(h, &c, sizeof(c));
+            h = hashBytes(h, &layer, sizeof(layer));
+
+            if (scissor)
+            {
+                h = hashBytes(h, &clip, sizeof(clip));
+            }
+            queue.keys.push_back({ h, b });
+        }
+
+        // Backwards, so the earlier keys folded in are still unmixed.
+        for (size_t i = queue.keys.size(); i-- > first + 1;)
+        {
+            gfxCmdKey& k = queue.keys[i];
+            for (size_t j = first; j < i; ++j)
+            {
+                if (overlaps(k.bounds, queue.keys[j].bounds))
+                {
+                    k.key = hashBytes(k.key, &queue.keys[j].key, sizeof(uint64_t));
+                }
+            }
+        }
+    }
+
+    std::sort(queue.keys.begin(), queue.keys.end(),
+              [](const gfxCmdKey& a, const gfxCmdKey& b) { return a.key < b.key; });
+}
+
+void Imgui::updateDamage()
+{
+    gfxCmdQueue& cur = renderQueue;
+    gfxCmdQueue& prev = frameQueue;
+
+    updateKeys(cur);
+    if (prev.keys.empty() && prev.size() > 0)
+    {
+        updateKeys(prev);
+    }
+
+    // Commands present in only one of the two frames damage their bounds.
+    damageBoxes.clear();
+    size_t i = 0, j = 0;
+    while (i < cur.keys.size() || j < prev.keys.size())
+    {
+        if (j == prev.keys.size() || (i < cur.keys.size() && cur.keys[i].key < prev.keys[j].key))
+        {
+            addDamage(damageBoxes, cur.keys[i++].bounds);
+        }
+        else if (i == cur.keys.size() || prev.keys[j].key < cur.keys[i].key)
+        {
+            addDamage(damageBoxes, prev.keys[j++].bounds);
+        }
+        else
+        {
+            ++i;
+            ++j;
+        }
+    }
+
+    cur.damage.clear();
+    for (const gfxBox& b : damageBoxes)
+    {
+        cur.damage.push_back({ (int)b.x0, (int)b.y0, (int)(b.x1 - b.x0), (int)(b.y1 - b.y0) });
+    }
+}
+
+static bool isNoOp(const gfxCmd& cmd)
+{
+    if ((cmd.col >> 24) == 0)
+    {
+        return true;
+    }
+    switch (cmd.type)
+    {
+    case GFXCMD_RECT:
+    case GFXCMD_TRIANGLE:
+    case GFXCMD_TEXTURED_RECT:
+        return cmd.rect.w <= 0 || cmd.rect.h <= 0;
+    case GFXCMD_TEXT:
+        return cmd.text.length == 0;
+    default:
+        return false;
+    }
+}
+static bool sameScissor(const gfxCmd& a, const gfxCmd& b)
+{
+    return a.flags == b.flags &&
+           (!a.flags || (a.rect.x == b.rect.x && a.rect.y == b.rect.y &&
+                         a.rect.w == b.rect.w && a.rect.h == b.rect.h));
+}
+// Sharp rects of the same colour sharing a full edge become one rect.
+static bool mergeRects(gfxCmd& a, const gfxCmd& b)
+{
+    if (a.type != GFXCMD_RECT || b.type != GFXCMD_RECT ||
+        a.rect.r != 0 || b.rect.r != 0 || a.col != b.col)
+    {
+        return false;
+    }
+    if (a.rect.y == b.rect.y && a.rect.h == b.rect.h &&
+        (a.rect.x + a.rect.w == b.rect.x || b.rect.x + b.rect.w == a.rect.x))
+    {
+        a.rect.x = std::min(a.rect.x, b.rect.x);
+        a.rect.w += b.rect.w;
+        return true;
+    }
+    if (a.rect.x == b.rect.x && a.rect.w == b.rect.w &&
+        (a.rect.y + a.rect.h == b.rect.y || b.rect.y + b.rect.h == a.rect.y))
+    {
+        a.rect.y = std::min(a.rect.y, b.rect.y);
+        a.rect.h += b.rect.h;
+        return true;
+    }
+    return false;
+}
+
+static unsigned optimizeLayer(std::vector<gfxCmd>& cmds, const char* arena)
+{
+    // Scissor changes are deferred until something is drawn under them, so
+    // toggles with nothing in between fold away.
+    gfxCmd active = {};
+    active.type = GFXCMD_SCISSOR;
+    gfxCmd pending = active;
+
+    size_t out = 0;
+    for (size_t i = 0; i < cmds.size(); ++i)
+    {
+        const gfxCmd cmd = cmds[i];
+        if (cmd.type == GFXCMD_SCISSOR)
+        {
+            pending = cmd;
+            continue;
+        }
+        if (isNoOp(cmd))
+        {
+            continue;
+        }
+        if (pending.flags)
+        {
+            const gfxBox clip = { pending.rect.x, pending.rect.y,
+                                  pending.rect.x + pending.rect.w, pending.rect.y + pending.rect.h };
+            if (!overlaps(gfxCmdBounds(cmd, arena), clip))
+            {
+                continue;
+            }
+        }
+        if (!sameScissor(pending, active))
+        {
+            cmds[out++] = pending;
+            active = pending;
+        }
+        if (out > 0 && mergeRects(cmds[out - 1], cmd))
+        {
+            continue;
+        }
+        cmds[out++] = cmd;
+    }
+
+    unsigned removed = (unsigned)(cmds.size() - out);
+    cmds.resize(out);
+    return removed;
+}
+
+unsigned Imgui::optimizeGfxCmdQueue()
+{
+    unsigned removed = 0;
+    for (std::vector<gfxCmd>& cmds : frameQueue.layers)
+    {
+        removed += optimizeLayer(cmds, frameQueue.arena.data());
+    }
+    return removed;
 }
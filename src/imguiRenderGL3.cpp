@@ -20,10 +20,24 @@
 
 // Heavily modified Luca Deltodesco 2014 https://github.com/deltaluca/imgui
 
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
 
 #include "imguiRenderGL3.h"
+#include "imguiTessellate.h"
+
+// Polygon tessellation uses SSE2 or AArch64 NEON where the compiler targets
+// them, unless IMGUI_NO_SIMD is defined.
+#if !defined(IMGUI_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IMGUI_SIMD 1
+#include <emmintrin.h>
+#elif !defined(IMGUI_NO_SIMD) && defined(__ARM_NEON) && defined(__aarch64__)
+#define IMGUI_SIMD 1
+#include <arm_neon.h>
+#endif
 
 #ifndef PI
 #define PI 3.14159265f
@@ -49,14 +63,151 @@ void* imguimalloc(size_t size, void* /*userptr*/)
 
 using namespace imgui;
 
-void ImguiRenderGL3::drawTexturedPolygon(const float* coords, unsigned numCoords, float r, uint32_t col, GLuint tex, float tx0, float ty0, float tx1, float ty1)
+static bool sameDrawState(const DrawCall& a, const DrawCall& b)
 {
-    if (numCoords > TEMP_COORD_COUNT) numCoords = TEMP_COORD_COUNT;
+    if (a.texture != b.texture || a.clipSet != b.clipSet || a.scissor != b.scissor)
+    {
+        return false;
+    }
+    return !a.scissor || memcmp(a.clip, b.clip, sizeof(a.clip)) == 0;
+}
+
+// Appends count vertices to the stream and returns the index of the first.
+uint32_t ImguiRenderGL3::allocVertices(unsigned count)
+{
+    StreamTarget& stream = state.stream;
+    uint32_t first = stream.vertexCount;
+    stream.vertexCount += count;
+    if (stream.vertexCount > stream.vertexCapacity)
+    {
+        growStream();
+    }
+    stats.vertices += count;
+    return first;
+}
+
+// Appends count indices drawn with state.next, returning where to write them.
+uint32_t* ImguiRenderGL3::allocIndices(unsigned count)
+{
+    StreamTarget& stream = state.stream;
+    uint32_t first = stream.indexCount;
+    if (state.draws.empty() || !sameDrawState(state.draws.back(), state.next))
+    {
+        state.draws.push_back(state.next);
+        state.draws.back().first = first;
+        state.draws.back().count = 0;
+    }
+    state.draws.back().count += count;
+
+    stream.indexCount += count;
+    if (stream.indexCount > stream.indexCapacity)
+    {
+        growStream();
+    }
+    return stream.indices + first;
+}
+
+// Removes the last vertices and indices appended to the stream.
+void ImguiRenderGL3::freeTail(unsigned vertexCount, unsigned indexCount)
+{
+    state.stream.vertexCount -= vertexCount;
+    state.stream.indexCount -= indexCount;
+    stats.vertices -= vertexCount;
+    state.draws.back().count -= indexCount;
+    if (state.draws.back().count == 0)
+    {
+        state.draws.pop_back();
+    }
+}
+
+// Makes room for the counts of the stream. A ring region cannot grow, so
+// the rest of the frame goes to the vectors and is tessellated again.
+void ImguiRenderGL3::growStream()
+{
+    StreamTarget& stream = state.stream;
+    if (!stream.vertexStore)
+    {
+        state.streamSpilled = true;
+        stream.vertexStore = &state.vertices;
+        stream.indexStore = &state.indices;
+    }
+    if (stream.vertexCount > stream.vertexStore->size())
+    {
+        stream.vertexStore->resize(stream.vertexCount);
+    }
+    if (stream.indexCount > stream.indexStore->size())
+    {
+        stream.indexStore->resize(stream.indexCount);
+    }
+    stream.vertices = stream.vertexStore->data();
+    stream.indices = stream.indexStore->data();
+    stream.vertexCapacity = (uint32_t)stream.vertexStore->size();
+    stream.indexCapacity = (uint32_t)stream.indexStore->size();
+}
+
+#if IMGUI_SIMD
+// Two points per vector, as x0, y0, x1, y1. The kernels do the same float
+// operations as the scalar code, so both give identical vertices unless the
+// compiler contracts the scalar multiply-adds, as GCC does on AArch64.
+#if defined(__ARM_NEON)
+typedef float32x4_t f4;
+typedef uint32x4_t m4;
+static inline f4 f4load(const float* p) { return vld1q_f32(p); }
+static inline void f4store(float* p, f4 a) { vst1q_f32(p, a); }
+static inline f4 f4set(float x, float y) { const float v[4] = {x, y, x, y}; return vld1q_f32(v); }
+static inline f4 f4add(f4 a, f4 b) { return vaddq_f32(a, b); }
+static inline f4 f4sub(f4 a, f4 b) { return vsubq_f32(a, b); }
+static inline f4 f4mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+static inline f4 f4div(f4 a, f4 b) { return vdivq_f32(a, b); }
+static inline f4 f4sqrt(f4 a) { return vsqrtq_f32(a); }
+static inline f4 f4min(f4 a, f4 b) { return vminq_f32(a, b); }
+static inline f4 f4max(f4 a, f4 b) { return vmaxq_f32(a, b); }
+static inline f4 f4swap(f4 a) { return vrev64q_f32(a); }
+static inline f4 f4high(f4 a) { return vcombine_f32(vget_high_f32(a), vget_high_f32(a)); }
+static inline m4 f4greater(f4 a, f4 b) { return vcgtq_f32(a, b); }
+static inline f4 f4select(m4 m, f4 a, f4 b) { return vbslq_f32(m, a, b); }
+static inline void f4toInt(int32_t* p, f4 a) { vst1q_s32(p, vcvtq_s32_f32(a)); }
+#else
+typedef __m128 f4;
+typedef __m128 m4;
+static inline f4 f4load(const float* p) { return _mm_loadu_ps(p); }
+static inline void f4store(float* p, f4 a) { _mm_storeu_ps(p, a); }
+static inline f4 f4set(float x, float y) { return _mm_setr_ps(x, y, x, y); }
+static inline f4 f4add(f4 a, f4 b) { return _mm_add_ps(a, b); }
+static inline f4 f4sub(f4 a, f4 b) { return _mm_sub_ps(a, b); }
+static inline f4 f4mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+static inline f4 f4div(f4 a, f4 b) { return _mm_div_ps(a, b); }
+static inline f4 f4sqrt(f4 a) { return _mm_sqrt_ps(a); }
+static inline f4 f4min(f4 a, f4 b) { return _mm_min_ps(a, b); }
+static inline f4 f4max(f4 a, f4 b) { return _mm_max_ps(a, b); }
+static inline f4 f4swap(f4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)); }
+static inline f4 f4high(f4 a) { return _mm_movehl_ps(a, a); }
+static inline m4 f4greater(f4 a, f4 b) { return _mm_cmpgt_ps(a, b); }
+static inline f4 f4select(m4 m, f4 a, f4 b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+static inline void f4toInt(int32_t* p, f4 a) { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(a)); }
+#endif
+#endif
 
-    for (unsigned i = 0, j = numCoords-1; i < numCoords; j=i++)
+void imgui::polygonNormals(const float* coords, unsigned n, float* normals)
+{
+    unsigned i = 0;
+#if IMGUI_SIMD
+    const f4 zero = f4set(0, 0);
+    const f4 one = f4set(1, 1);
+    const f4 flip = f4set(1, -1);
+    for (; i + 2 < n; i += 2)
+    {
+        f4 d = f4sub(f4load(coords + i*2 + 2), f4load(coords + i*2));
+        const f4 d2 = f4mul(d, d);
+        const f4 len = f4sqrt(f4add(d2, f4swap(d2)));
+        d = f4select(f4greater(len, zero), f4mul(d, f4div(one, len)), d);
+        f4store(normals + i*2, f4mul(f4swap(d), flip));
+    }
+#endif
+    for (; i < n; ++i)
     {
-        const float* v0 = &coords[j*2];
-        const float* v1 = &coords[i*2];
+        const float* v0 = &coords[i*2];
+        const float* v1 = &coords[(i + 1 < n ? i + 1 : 0)*2];
         float dx = v1[0] - v0[0];
         float dy = v1[1] - v0[1];
         float d = sqrtf(dx*dx+dy*dy);
@@ -66,175 +217,245 @@ void ImguiRenderGL3::drawTexturedPolygon(const float* coords, unsigned numCoords
             dx *= d;
             dy *= d;
         }
-        state.tempNormals[j*2+0] = dy;
-        state.tempNormals[j*2+1] = -dx;
-    }
-
-    float colf[4] = { (float) (col&0xff) / 255.f, (float) ((col>>8)&0xff) / 255.f, (float) ((col>>16)&0xff) / 255.f, (float) ((col>>24)&0xff) / 255.f};
-    float colTransf[4] = { (float) (col&0xff) / 255.f, (float) ((col>>8)&0xff) / 255.f, (float) ((col>>16)&0xff) / 255.f, 0};
-
-    for (unsigned i = 0, j = numCoords-1; i < numCoords; j=i++)
-    {
-        float dlx0 = state.tempNormals[j*2+0];
-        float dly0 = state.tempNormals[j*2+1];
-        float dlx1 = state.tempNormals[i*2+0];
-        float dly1 = state.tempNormals[i*2+1];
-        float dmx = (dlx0 + dlx1) * 0.5f;
-        float dmy = (dly0 + dly1) * 0.5f;
-        float   dmr2 = dmx*dmx + dmy*dmy;
-        if (dmr2 > 0.000001f)
-        {
-            float   scale = 1.0f / dmr2;
-            if (scale > 10.0f) scale = 10.0f;
-            dmx *= scale;
-            dmy *= scale;
-        }
-        state.tempCoords[i*2+0] = coords[i*2+0]+dmx*r;
-        state.tempCoords[i*2+1] = coords[i*2+1]+dmy*r;
-    }
-
-    int vSize = numCoords * 12 + (numCoords - 2) * 6;
-    int uvSize = numCoords * 2 * 6 + (numCoords - 2) * 2 * 3;
-    int cSize = numCoords * 4 * 6 + (numCoords - 2) * 4 * 3;
-    float * v = state.tempVertices;
-    float * uv = state.tempTextureCoords;
-    memset(uv, 0, uvSize * sizeof(float));
-    float * c = state.tempColors;
-    memset(c, 1, cSize * sizeof(float));
-
-    float * ptrV = v;
-    float * ptrC = c;
-    float * ptrUV = uv;
-    for (unsigned i = 0, j = numCoords-1; i < numCoords; j=i++)
-    {
-        *ptrV = coords[i*2];
-        *(ptrV+1) = coords[i*2 + 1];
-        ptrV += 2;
-        *ptrV = coords[j*2];
-        *(ptrV+1) = coords[j*2 + 1];
-        ptrV += 2;
-        *ptrV = state.tempCoords[j*2];
-        *(ptrV+1) = state.tempCoords[j*2 + 1];
-        ptrV += 2;
-        *ptrV = state.tempCoords[j*2];
-        *(ptrV+1) = state.tempCoords[j*2 + 1];
-        ptrV += 2;
-        *ptrV = state.tempCoords[i*2];
-        *(ptrV+1) = state.tempCoords[i*2 + 1];
-        ptrV += 2;
-        *ptrV = coords[i*2];
-        *(ptrV+1) = coords[i*2 + 1];
-        ptrV += 2;
-
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
-        *ptrC = colTransf[0];
-        *(ptrC+1) = colTransf[1];
-        *(ptrC+2) = colTransf[2];
-        *(ptrC+3) = colTransf[3];
-        ptrC += 4;
-        *ptrC = colTransf[0];
-        *(ptrC+1) = colTransf[1];
-        *(ptrC+2) = colTransf[2];
-        *(ptrC+3) = colTransf[3];
-        ptrC += 4;
-        *ptrC = colTransf[0];
-        *(ptrC+1) = colTransf[1];
-        *(ptrC+2) = colTransf[2];
-        *(ptrC+3) = colTransf[3];
-        ptrC += 4;
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
+        normals[i*2+0] = dy;
+        normals[i*2+1] = -dx;
     }
+}
 
-    for (unsigned i = 2; i < numCoords; ++i)
+static void miterPoint(const float* coords, const float* normals, unsigned n, float r, float* out, unsigned i)
+{
+    const unsigned j = i ? i - 1 : n - 1;
+    float dmx = (normals[j*2+0] + normals[i*2+0]) * 0.5f;
+    float dmy = (normals[j*2+1] + normals[i*2+1]) * 0.5f;
+    float   dmr2 = dmx*dmx + dmy*dmy;
+    if (dmr2 > 0.000001f)
     {
-        *ptrV = coords[0];
-        *(ptrV+1) = coords[1];
-        ptrV += 2;
-        *ptrV = coords[(i-1)*2];
-        *(ptrV+1) = coords[(i-1)*2+1];
-        ptrV += 2;
-        *ptrV = coords[i*2];
-        *(ptrV+1) = coords[i*2 + 1];
-        ptrV += 2;
-
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
-        *ptrC = colf[0];
-        *(ptrC+1) = colf[1];
-        *(ptrC+2) = colf[2];
-        *(ptrC+3) = colf[3];
-        ptrC += 4;
-    }
-
-    float minX = 1e10;
-    float minY = 1e10;
-    float maxX = -1e10;
-    float maxY = -1e10;
-    for (float * ptrV2 = v; ptrV2 != ptrV; ptrV2 += 2)
-    {
-        minX = (minX < *ptrV2) ? minX : *ptrV2;
-        maxX = (maxX > *ptrV2) ? maxX : *ptrV2;
-        minY = (minY < *(ptrV2+1)) ? minY : *(ptrV2+1);
-        maxY = (maxY > *(ptrV2+1)) ? maxY : *(ptrV2+1);
-    }
-
-    float scaleX = (tx1 - tx0) / (maxX - minX);
-    float scaleY = (ty1 - ty0) / (maxY - minY);
-
-    for (float * ptrUV = uv, * ptrV2 = v; ptrV2 != ptrV; ptrV2 += 2, ptrUV += 2)
-    {
-        *ptrUV       = ((*ptrV2) - minX) * scaleX + tx0;
-        *(ptrUV + 1) = ((*(ptrV2 + 1)) - minY) * scaleY + ty0;
+        float   scale = 1.0f / dmr2;
+        if (scale > 10.0f) scale = 10.0f;
+        dmx *= scale;
+        dmy *= scale;
     }
+    out[i*2+0] = coords[i*2+0]+dmx*r;
+    out[i*2+1] = coords[i*2+1]+dmy*r;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
+void imgui::polygonMiters(const float* coords, const float* normals, unsigned n, float r, float* out)
+{
+    // The first point pairs the last normal with the first.
+    miterPoint(coords, normals, n, r, out, 0);
+    unsigned i = 1;
+#if IMGUI_SIMD
+    const f4 half = f4set(0.5f, 0.5f);
+    const f4 one = f4set(1, 1);
+    const f4 limit = f4set(10, 10);
+    const f4 eps = f4set(0.000001f, 0.000001f);
+    const f4 fr = f4set(r, r);
+    for (; i + 1 < n; i += 2)
+    {
+        f4 dm = f4mul(f4add(f4load(normals + i*2 - 2), f4load(normals + i*2)), half);
+        const f4 d2 = f4mul(dm, dm);
+        const f4 dmr2 = f4add(d2, f4swap(d2));
+        const f4 scale = f4min(f4div(one, dmr2), limit);
+        dm = f4select(f4greater(dmr2, eps), f4mul(dm, scale), dm);
+        f4store(out + i*2, f4add(f4load(coords + i*2), f4mul(dm, fr)));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        miterPoint(coords, normals, n, r, out, i);
+    }
+}
 
-    if (GLEW_ARB_vertex_array_object)
+void imgui::growBounds(const float* coords, unsigned n, float* bounds)
+{
+    // Locals, since bounds may alias coords as far as the compiler knows.
+    float minX = bounds[0], minY = bounds[1], maxX = bounds[2], maxY = bounds[3];
+    unsigned i = 0;
+#if IMGUI_SIMD
+    f4 mn = f4set(minX, minY);
+    f4 mx = f4set(maxX, maxY);
+    for (; i + 1 < n; i += 2)
     {
-        glBindVertexArray(state.vao);
+        const f4 p = f4load(coords + i*2);
+        mn = f4min(mn, p);
+        mx = f4max(mx, p);
     }
-    else
+    float lo[4], hi[4];
+    f4store(lo, f4min(mn, f4high(mn)));
+    f4store(hi, f4max(mx, f4high(mx)));
+    minX = lo[0];
+    minY = lo[1];
+    maxX = hi[0];
+    maxY = hi[1];
+#endif
+    for (; i < n; ++i)
+    {
+        minX = std::min(minX, coords[i*2+0]);
+        minY = std::min(minY, coords[i*2+1]);
+        maxX = std::max(maxX, coords[i*2+0]);
+        maxY = std::max(maxY, coords[i*2+1]);
+    }
+    bounds[0] = minX;
+    bounds[1] = minY;
+    bounds[2] = maxX;
+    bounds[3] = maxY;
+}
+
+static uint16_t unorm16(float f)
+{
+    f = f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+    return (uint16_t)(f * 65535.0f + 0.5f);
+}
+
+void imgui::polygonVertices(const float* coords, unsigned n, const float* bounds, float tx0, float ty0, float tx1, float ty1,
+                            uint32_t col, uint8_t mode, uint8_t clip, Vertex* v)
+{
+    if (!bounds)
+    {
+        for (unsigned i = 0; i < n; ++i)
+        {
+            v[i] = { coords[i*2], coords[i*2+1], 0, 0, col, mode, clip, {0, 0, 0} };
+        }
+        return;
+    }
+    const float scaleX = (tx1 - tx0) / (bounds[2] - bounds[0]);
+    const float scaleY = (ty1 - ty0) / (bounds[3] - bounds[1]);
+    unsigned i = 0;
+#if IMGUI_SIMD
+    const f4 origin = f4set(bounds[0], bounds[1]);
+    const f4 scale = f4set(scaleX, scaleY);
+    const f4 t0 = f4set(tx0, ty0);
+    const f4 zero = f4set(0, 0);
+    const f4 one = f4set(1, 1);
+    const f4 range = f4set(65535.0f, 65535.0f);
+    const f4 round = f4set(0.5f, 0.5f);
+    for (; i + 1 < n; i += 2)
+    {
+        f4 uv = f4add(f4mul(f4sub(f4load(coords + i*2), origin), scale), t0);
+        uv = f4max(f4min(uv, one), zero);
+        int32_t q[4];
+        f4toInt(q, f4add(f4mul(uv, range), round));
+        v[i] = { coords[i*2], coords[i*2+1], (uint16_t)q[0], (uint16_t)q[1], col, mode, clip, {0, 0, 0} };
+        v[i+1] = { coords[i*2+2], coords[i*2+3], (uint16_t)q[2], (uint16_t)q[3], col, mode, clip, {0, 0, 0} };
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        v[i] = { coords[i*2], coords[i*2+1],
+                 unorm16((coords[i*2+0] - bounds[0]) * scaleX + tx0),
+                 unorm16((coords[i*2+1] - bounds[1]) * scaleY + ty0),
+                 col, mode, clip, {0, 0, 0} };
+    }
+}
+
+void imgui::fringedPolygon(const float* coords, const float* fringe, unsigned n, float tx0, float ty0, float tx1, float ty1,
+                           uint32_t col, uint8_t mode, uint8_t clip, Vertex* v, uint32_t base, uint32_t* idx)
+{
+    // The shader ignores UVs of solid fills.
+    float bounds[4] = { 1e10, 1e10, -1e10, -1e10 };
+    const bool textured = mode == VERTEX_TEXTURE;
+    if (textured)
+    {
+        growBounds(coords, n, bounds);
+        growBounds(fringe, n, bounds);
+    }
+    const float* uvBounds = textured ? bounds : nullptr;
+
+    // Inner vertices come first, then their outward fringe copies.
+    const uint32_t colTrans = col & 0x00ffffff;
+    polygonVertices(coords, n, uvBounds, tx0, ty0, tx1, ty1, col, mode, clip, v);
+    polygonVertices(fringe, n, uvBounds, tx0, ty0, tx1, ty1, colTrans, mode, clip, v + n);
+
+    const uint32_t outer = base + n;
+    for (unsigned i = 0, j = n-1; i < n; j=i++)
+    {
+        *idx++ = base + i;
+        *idx++ = base + j;
+        *idx++ = outer + j;
+        *idx++ = outer + j;
+        *idx++ = outer + i;
+        *idx++ = base + i;
+    }
+
+    for (unsigned i = 2; i < n; ++i)
+    {
+        *idx++ = base;
+        *idx++ = base + i - 1;
+        *idx++ = base + i;
+    }
+}
+
+void ImguiRenderGL3::drawTexturedPolygon(const float* coords, unsigned numCoords, float r, uint32_t col, GLuint tex, float tx0, float ty0, float tx1, float ty1)
+{
+    if (numCoords > TEMP_COORD_COUNT) numCoords = TEMP_COORD_COUNT;
+
+    polygonNormals(coords, numCoords, state.tempNormals);
+    polygonMiters(coords, state.tempNormals, numCoords, r, state.tempCoords);
+
+    // Solid fills draw with whatever texture is bound.
+    const uint8_t mode = tex ? VERTEX_TEXTURE : VERTEX_SOLID;
+    if (tex)
+    {
+        state.next.texture = tex;
+    }
+
+    if (msaa)
+    {
+        drawFringelessPolygon(coords, numCoords, col, mode, tex, tx0, ty0, tx1, ty1);
+        return;
+    }
+    const uint32_t base = allocVertices(numCoords * 2);
+    uint32_t* idx = allocIndices(fringedPolygonIndexCount(numCoords));
+    fringedPolygon(coords, state.tempCoords, numCoords, tx0, ty0, tx1, ty1, col, mode, state.nextClip,
+                   state.stream.vertices + base, base, idx);
+}
+
+// Fills the polygon halfway out to the fringe in state.tempCoords, where a
+// multisampled target antialiases the edges itself. Textures map onto the
+// same bounds as with the fringe.
+void ImguiRenderGL3::drawFringelessPolygon(const float* coords, unsigned numCoords, uint32_t col, uint8_t mode, GLuint tex, float tx0, float ty0, float tx1, float ty1)
+{
+    float bounds[4] = { 1e10, 1e10, -1e10, -1e10 };
+    if (tex)
     {
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
-        glEnableVertexAttribArray(2);
+        growBounds(coords, numCoords, bounds);
+        growBounds(state.tempCoords, numCoords, bounds);
+    }
+    for (unsigned i = 0; i < numCoords*2; ++i)
+    {
+        state.tempCoords[i] = (coords[i] + state.tempCoords[i]) * 0.5f;
+    }
+
+    const uint32_t base = allocVertices(numCoords);
+    polygonVertices(state.tempCoords, numCoords, tex ? bounds : nullptr, tx0, ty0, tx1, ty1, col, mode, state.nextClip,
+                    state.stream.vertices + base);
+
+    uint32_t* idx = allocIndices((numCoords - 2) * 3);
+    for (unsigned i = 2; i < numCoords; ++i)
+    {
+        *idx++ = base;
+        *idx++ = base + i - 1;
+        *idx++ = base + i;
     }
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[0]);
-    glBufferData(GL_ARRAY_BUFFER, vSize*sizeof(float), v, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[1]);
-    glBufferData(GL_ARRAY_BUFFER, uvSize*sizeof(float), uv, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[2]);
-    glBufferData(GL_ARRAY_BUFFER, cSize*sizeof(float), c, GL_STREAM_DRAW);
-    glDrawArrays(GL_TRIANGLES, 0, (numCoords * 2 + numCoords - 2)*3);
 }
 
 void ImguiRenderGL3::drawPolygon(const float* coords, unsigned numCoords, float r, uint32_t col)
 {
-    drawTexturedPolygon(coords, numCoords, r, col, state.whitetex, 0, 0, 1, 1);
+    drawTexturedPolygon(coords, numCoords, r, col, 0, 0, 0, 1, 1);
 }
 
+// Vertex order of drawTexturedPolygon for a quad: the fringe ring, then
+// the fan.
+static const uint8_t rectIndices[30] =
+{
+    0, 3, 7, 7, 4, 0,
+    1, 0, 4, 4, 5, 1,
+    2, 1, 5, 5, 6, 2,
+    3, 2, 6, 6, 7, 3,
+    0, 1, 2,
+    0, 2, 3,
+};
+
 void ImguiRenderGL3:: drawRect(float x, float y, float w, float h, float fth, uint32_t col)
 {
     float verts[4*2] =
@@ -244,7 +465,42 @@ void ImguiRenderGL3:: drawRect(float x, float y, float w, float h, float fth, ui
         x+w-0.5f, y+h-0.5f,
         x+0.5f, y+h-0.5f,
     };
-    drawPolygon(verts, 4, fth, col);
+    // Any thinner and the inset polygon turns inside out, which only the
+    // general path handles.
+    if (w <= 1 || h <= 1)
+    {
+        drawPolygon(verts, 4, fth, col);
+        return;
+    }
+
+    // Axis aligned, so the normals need no computing: each corner's miter
+    // moves it fth out along both axes, or half that to the middle of the
+    // fringe when there is none.
+    const float e = msaa ? fth*0.5f : fth;
+    const float dir[4*2] = { -e, -e, e, -e, e, e, -e, e };
+    const unsigned count = msaa ? 4 : 8;
+    const uint32_t base = allocVertices(count);
+    Vertex* v = state.stream.vertices + base;
+    const uint32_t colTrans = col & 0x00ffffff;
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        if (msaa)
+        {
+            v[i] = { verts[i*2]+dir[i*2], verts[i*2+1]+dir[i*2+1], 0, 0, col, VERTEX_SOLID, state.nextClip, {0, 0, 0} };
+        }
+        else
+        {
+            v[i] = { verts[i*2], verts[i*2+1], 0, 0, col, VERTEX_SOLID, state.nextClip, {0, 0, 0} };
+            v[i+4] = { verts[i*2]+dir[i*2], verts[i*2+1]+dir[i*2+1], 0, 0, colTrans, VERTEX_SOLID, state.nextClip, {0, 0, 0} };
+        }
+    }
+
+    const unsigned first = msaa ? 24 : 0;
+    uint32_t* idx = allocIndices(30 - first);
+    for (unsigned i = first; i < 30; ++i)
+    {
+        *idx++ = base + rectIndices[i];
+    }
 }
 
 void ImguiRenderGL3:: drawTexturedRect(float x, float y, float w, float h, uint32_t texture, uint32_t col, float tx0, float ty0, float tx1, float ty1)
@@ -259,11 +515,23 @@ void ImguiRenderGL3:: drawTexturedRect(float x, float y, float w, float h, uint3
     drawTexturedPolygon(verts, 4, 1.0, col, texture, tx0, ty0, tx1, ty1);
 }
 
+// A chord spanning angle a deviates r * (1 - cos(a/2)) from the arc.
+static unsigned circleLevel(float r)
+{
+    unsigned level = 0;
+    while (level + 1 < CIRCLE_LEVELS && r * (1 - cosf(PI / (4 << level))) > CIRCLE_TOLERANCE)
+    {
+        ++level;
+    }
+    return level;
+}
+
 void ImguiRenderGL3:: drawRoundedRect(float x, float y, float w, float h, float r, float fth, uint32_t col)
 {
-    const unsigned n = CIRCLE_VERTS/4;
-    float verts[(n+1)*4*2];
-    const float* cverts = state.circleVerts;
+    const unsigned level = circleLevel(r);
+    const unsigned n = 1 << level;
+    float verts[(CIRCLE_MAX_VERTS/4+1)*4*2];
+    const float* cverts = state.circleVerts[level];
     float* v = verts;
 
     for (unsigned i = 0; i <= n; ++i)
@@ -332,15 +600,217 @@ void ImguiRenderGL3:: drawLine(float x0, float y0, float x1, float y1, float r,
     drawPolygon(verts, 4, fth, col);
 }
 
+static uint32_t tessCacheSet(TessShape shape, float w, float h, float r, float fth)
+{
+    uint32_t k[5];
+    k[0] = shape;
+    memcpy(&k[1], &w, sizeof(float));
+    memcpy(&k[2], &h, sizeof(float));
+    memcpy(&k[3], &r, sizeof(float));
+    memcpy(&k[4], &fth, sizeof(float));
+    uint32_t hash = 2166136261u;
+    for (uint32_t word : k)
+    {
+        hash = (hash ^ word) * 16777619u;
+    }
+    return (hash ^ (hash >> 16)) % TESS_CACHE_SETS;
+}
+
+// Draws a rounded rect or triangle with its top left corner at (x, y),
+// reusing the tessellation of an earlier shape of the same size.
+void ImguiRenderGL3::drawCachedShape(TessShape shape, float x, float y, float w, float h, float r, float fth, uint32_t col)
+{
+    TessCacheEntry* set = &state.tessCache[tessCacheSet(shape, w, h, r, fth) * TESS_CACHE_WAYS];
+    TessCacheEntry* entry = nullptr;
+    TessCacheEntry* victim = set;
+    ++state.tessCacheClock;
+    for (unsigned i = 0; i < TESS_CACHE_WAYS; ++i)
+    {
+        TessCacheEntry& e = set[i];
+        if (e.shape == shape && e.w == w && e.h == h && e.r == r && e.fth == fth && e.msaa == msaa)
+        {
+            entry = &e;
+            break;
+        }
+        if (e.lastUse < victim->lastUse)
+        {
+            victim = &e;
+        }
+    }
+    if (entry)
+    {
+        stats.tessCacheHits++;
+    }
+    else
+    {
+        stats.tessCacheMisses++;
+        entry = victim;
+        tessellateShape(*entry, shape, w, h, r, fth);
+    }
+    entry->lastUse = state.tessCacheClock;
+
+    const TessCacheEntry& e = *entry;
+    const uint32_t base = allocVertices((unsigned)e.vertices.size());
+    Vertex* v = state.stream.vertices + base;
+    for (const Vertex& t : e.vertices)
+    {
+        *v = t;
+        v->x += x;
+        v->y += y;
+        v->col &= col;
+        v->clip = state.nextClip;
+        ++v;
+    }
+    uint32_t* idx = allocIndices((unsigned)e.indices.size());
+    for (uint32_t t : e.indices)
+    {
+        *idx++ = base + t;
+    }
+}
+
+// Tessellates a shape at the origin into a cache entry, in white so the
+// colours come out as masks. The stream may be mapped memory that must not
+// be read back, so the entry's vectors stand in for it meanwhile.
+void ImguiRenderGL3::tessellateShape(TessCacheEntry& e, TessShape shape, float w, float h, float r, float fth)
+{
+    const StreamTarget stream = state.stream;
+    state.stream = StreamTarget();
+    state.stream.vertexStore = &e.vertices;
+    state.stream.indexStore = &e.indices;
+    const uint32_t col = 0xffffffff;
+    if (shape == TESS_ROUNDED_RECT)
+    {
+        drawRoundedRect(0, 0, w, h, r, fth, col);
+    }
+    else if (shape == TESS_TRIANGLE_RIGHT)
+    {
+        const float verts[3*2] = { 0, 0, w, h*0.5f, 0, h };
+        drawPolygon(verts, 3, fth, col);
+    }
+    else
+    {
+        const float verts[3*2] = { 0, h, w*0.5f, 0, w, h };
+        drawPolygon(verts, 3, fth, col);
+    }
+
+    e.vertices.resize(state.stream.vertexCount);
+    e.indices.resize(state.stream.indexCount);
+    freeTail(state.stream.vertexCount, state.stream.indexCount);
+    state.stream = stream;
+
+    e.shape = shape;
+    e.w = w;
+    e.h = h;
+    e.r = r;
+    e.fth = fth;
+    e.msaa = msaa;
+}
+
+static int16_t toFixed8(float f)
+{
+    f = f * 8.0f + (f < 0 ? -0.5f : 0.5f);
+    return (int16_t)(f < -32768.0f ? -32768.0f : (f > 32767.0f ? 32767.0f : f));
+}
+
+// Appends a quad covering local [local[0], local[2]] x [local[1], local[3]]
+// around the origin (ox, oy). The local x axis runs along (dx, dy) and the
+// local y axis along (-dy, dx).
+void ImguiRenderGL3::drawShapeQuad(float ox, float oy, float dx, float dy, const float* local, float hx, float hy, float r, uint8_t mode, uint32_t col)
+{
+    const uint32_t base = allocVertices(4);
+    Vertex* v = state.stream.vertices + base;
+    for (int i = 0; i < 4; ++i)
+    {
+        const float lx = local[(i & 1) ? 2 : 0];
+        const float ly = local[(i & 2) ? 3 : 1];
+        v[i].x = ox + dx * lx - dy * ly;
+        v[i].y = oy + dy * lx + dx * ly;
+        v[i].u = (uint16_t)(toFixed8(lx) + 32768);
+        v[i].v = (uint16_t)(toFixed8(ly) + 32768);
+        v[i].col = col;
+        v[i].mode = mode;
+        v[i].clip = state.nextClip;
+        v[i].shape[0] = toFixed8(hx);
+        v[i].shape[1] = toFixed8(hy);
+        v[i].shape[2] = toFixed8(r);
+    }
+    uint32_t* idx = allocIndices(6);
+    idx[0] = base + 0;
+    idx[1] = base + 1;
+    idx[2] = base + 3;
+    idx[3] = base + 0;
+    idx[4] = base + 3;
+    idx[5] = base + 2;
+}
+
+// SDF counterpart of the tessellated shapes in tessellateCommands. Edges are
+// placed where the middle of the tessellated AA fringe would be, and the
+// quads reach one pixel past them for the shader's antialiasing.
+void ImguiRenderGL3::drawShape(const gfxCmd& cmd)
+{
+    const float s = 1.0f/8.0f;
+    if (cmd.type == GFXCMD_RECT)
+    {
+        const float w = cmd.rect.w*s, h = cmd.rect.h*s;
+        // Rounded rects are tessellated half a pixel larger than plain ones.
+        const float inset = cmd.rect.r == 0 ? 0.5f : 0.0f;
+        const float r = cmd.rect.r == 0 ? 0.0f : cmd.rect.r*s + 0.5f;
+        const float hx = w*0.5f - inset, hy = h*0.5f - inset;
+        const float local[4] = { -hx-1, -hy-1, hx+1, hy+1 };
+        drawShapeQuad(cmd.rect.x*s + w*0.5f, cmd.rect.y*s + h*0.5f, 1, 0, local, hx, hy, std::min(r, std::min(hx, hy)), VERTEX_SDF_BOX, cmd.col);
+    }
+    else if (cmd.type == GFXCMD_LINE)
+    {
+        float dx = (cmd.line.x1 - cmd.line.x0)*s;
+        float dy = (cmd.line.y1 - cmd.line.y0)*s;
+        const float len = sqrtf(dx*dx + dy*dy);
+        if (len > 0.0001f)
+        {
+            dx /= len;
+            dy /= len;
+        }
+        else
+        {
+            dx = 1;
+            dy = 0;
+        }
+        const float hw = std::max((cmd.line.r*s - 1.0f) * 0.5f, 0.01f) + 0.5f;
+        const float hx = len*0.5f + hw;
+        const float local[4] = { -hx-1, -hw-1, hx+1, hw+1 };
+        drawShapeQuad((cmd.line.x0 + cmd.line.x1)*0.5f*s, (cmd.line.y0 + cmd.line.y1)*0.5f*s, dx, dy, local, hx, hw, 0, VERTEX_SDF_BOX, cmd.col);
+    }
+    else if (cmd.type == GFXCMD_TRIANGLE && (cmd.flags == 1 || cmd.flags == 2))
+    {
+        // The apex sits at the local origin and the base at local y = height.
+        const float x = cmd.rect.x*s, y = cmd.rect.y*s, w = cmd.rect.w*s, h = cmd.rect.h*s;
+        const bool right = cmd.flags == 1;
+        const float hw = ((right ? h : w) - 1) * 0.5f;
+        const float height = (right ? w : h) - 1;
+        const float local[4] = { -hw-1.5f, -1.5f, hw+1.5f, height+1.5f };
+        if (right)
+        {
+            drawShapeQuad(x + w - 0.5f, y + h*0.5f, 0, 1, local, hw, height, 0.5f, VERTEX_SDF_TRIANGLE, cmd.col);
+        }
+        else
+        {
+            drawShapeQuad(x + w*0.5f, y + 0.5f, 1, 0, local, hw, height, 0.5f, VERTEX_SDF_TRIANGLE, cmd.col);
+        }
+    }
+}
+
 bool ImguiRenderGL3::init(const std::string& fontpath)
 {
     initialized = true;
 
-    for (int i = 0; i < CIRCLE_VERTS; ++i)
+    for (unsigned level = 0; level < CIRCLE_LEVELS; ++level)
     {
-        float a = (float)i/(float)CIRCLE_VERTS * PI*2;
-        state.circleVerts[i*2+0] = cosf(a);
-        state.circleVerts[i*2+1] = sinf(a);
+        const unsigned count = 4 << level;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            float a = (float)i/(float)count * PI*2;
+            state.circleVerts[level][i*2+0] = cosf(a);
+            state.circleVerts[level][i*2+1] = sinf(a);
+        }
     }
 
     // Load font.
@@ -370,6 +840,21 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
 
     stbtt_BakeFontBitmap(ttfBuffer,0, 15.0f, bmap,512,512, 32,96, (stbtt_bakedchar*)state.cdata);
 
+    state.fontAscent = 0;
+    state.fontDescent = 0;
+    state.fontMinXOff = 0;
+    for (int i = 0; i < 96; ++i)
+    {
+        const stbtt_bakedchar& b = state.cdata[i];
+        state.glyphUV[i][0] = unorm16(b.x0 / 512.0f);
+        state.glyphUV[i][1] = unorm16(b.y0 / 512.0f);
+        state.glyphUV[i][2] = unorm16(b.x1 / 512.0f);
+        state.glyphUV[i][3] = unorm16(b.y1 / 512.0f);
+        state.fontAscent = std::max(state.fontAscent, -b.yoff);
+        state.fontDescent = std::max(state.fontDescent, (b.y1 - b.y0) + b.yoff);
+        state.fontMinXOff = std::min(state.fontMinXOff, b.xoff);
+    }
+
     // can free ttf_buffer at this point
     glGenTextures(1, &state.ftex);
     glActiveTexture(GL_TEXTURE0);
@@ -378,21 +863,13 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // can free ttf_buffer at this point
-    unsigned char white_alpha = 255;
-    glGenTextures(1, &state.whitetex);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, state.whitetex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_INTENSITY, 1, 1, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, &white_alpha);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     // needed imgui to work with GL 2.1... no VAO :'(
     if (GLEW_ARB_vertex_array_object)
     {
         glGenVertexArrays(1, &state.vao);
     }
-    glGenBuffers(3, state.vbos);
+    glGenBuffers(1, &state.vbo);
+    glGenBuffers(1, &state.ibo);
 
     if (GLEW_ARB_vertex_array_object)
     {
@@ -401,18 +878,15 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+    glEnableVertexAttribArray(5);
 
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[0]);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*2, (void*)0);
-    glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[1]);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*2, (void*)0);
-    glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[2]);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*4, (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
     glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_STREAM_DRAW);
+
+    state.useRing = GLEW_ARB_buffer_storage && GLEW_ARB_sync;
     state.program = glCreateProgram();
-    state.font_program = glCreateProgram();
 
     const char * vs =
     "#version 120\n"
@@ -420,12 +894,24 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
     "attribute vec2 VertexPosition;\n"
     "attribute vec2 VertexTexCoord;\n"
     "attribute vec4 VertexColor;\n"
+    "attribute float VertexMode;\n"
+    "attribute float VertexClip;\n"
+    "attribute vec3 VertexShape;\n"
     "varying vec2 texCoord;\n"
     "varying vec4 vertexColor;\n"
+    "varying float mode;\n"
+    "varying float clip;\n"
+    "varying vec3 shape;\n"
     "void main(void)\n"
     "{\n"
     "    vertexColor = VertexColor;\n"
-    "    texCoord = VertexTexCoord;\n"
+    "    if (VertexMode > 2.5)\n"
+    "        texCoord = (VertexTexCoord - 32768.0) / 8.0;\n"
+    "    else\n"
+    "        texCoord = VertexTexCoord / 65535.0;\n"
+    "    mode = VertexMode;\n"
+    "    clip = VertexClip;\n"
+    "    shape = VertexShape / 8.0;\n"
     "    gl_Position = vec4(VertexPosition * 2.0 / Viewport - 1.0, 0.f, 1.0);\n"
     "}\n";
     GLuint vso = glCreateShader(GL_VERTEX_SHADER);
@@ -450,33 +936,64 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
     }
 
     glAttachShader(state.program, vso);
-    glAttachShader(state.font_program, vso);
 
-    const char * fs2 =
-    "#version 120\n"
+    // Mode 0 is a solid fill, 1 takes coverage from the font atlas on unit
+    // 0 and 2 samples the BGRA user texture bound to unit 1. Modes 3 and 4
+    // take coverage from the distance to a rounded box of half extents
+    // shape.xy and radius shape.z, or to a triangle with its apex at the
+    // origin, base half width shape.x at height shape.y, grown by shape.z.
+    // A non-zero clip selects a rect in Clips, as x0, y0, x1, y1 in window
+    // pixels. The body is shared with the vertex pulling program, which
+    // compiles it as GLSL 4.30.
+    const char * fsBody =
     "varying vec2 texCoord;\n"
     "varying vec4 vertexColor;\n"
+    "varying float mode;\n"
+    "varying float clip;\n"
+    "varying vec3 shape;\n"
+    "uniform sampler2D FontTexture;\n"
     "uniform sampler2D Texture;\n"
-    "void main(void)\n"
+    "uniform vec4 Clips[16];\n"
+    "float box(vec2 p, vec2 b, float r)\n"
     "{\n"
-    "    gl_FragColor = vertexColor * texture2D(Texture, texCoord).bgra;\n"
-    "}\n";
-    GLuint fso2 = glCreateShader(GL_FRAGMENT_SHADER);
-
-    const char * fs =
-    "#version 120\n"
-    "varying vec2 texCoord;\n"
-    "varying vec4 vertexColor;\n"
-    "uniform sampler2D Texture;\n"
+    "    vec2 q = abs(p) - b + r;\n"
+    "    return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0) - r;\n"
+    "}\n"
+    "float triangle(vec2 p, vec2 q)\n"
+    "{\n"
+    "    p.x = abs(p.x);\n"
+    "    vec2 a = p - q * clamp(dot(p, q) / dot(q, q), 0.0, 1.0);\n"
+    "    vec2 b = p - q * vec2(clamp(p.x / q.x, 0.0, 1.0), 1.0);\n"
+    "    float s = -sign(q.y);\n"
+    "    vec2 d = min(vec2(dot(a, a), s * (p.x * q.y - p.y * q.x)),\n"
+    "                 vec2(dot(b, b), s * (p.y - q.y)));\n"
+    "    return -sqrt(d.x) * sign(d.y);\n"
+    "}\n"
     "void main(void)\n"
     "{\n"
-    "    gl_FragColor = vertexColor * vec4(1, 1, 1, texture2D(Texture, texCoord).a);\n"
+    "    if (clip > 0.5)\n"
+    "    {\n"
+    "        vec4 r = Clips[int(clip - 0.5)];\n"
+    "        if (any(lessThan(gl_FragCoord.xy, r.xy)) || any(greaterThanEqual(gl_FragCoord.xy, r.zw)))\n"
+    "            discard;\n"
+    "    }\n"
+    "    vec4 t = vec4(1.0);\n"
+    "    if (mode > 3.5)\n"
+    "        t.a = clamp(0.5 - triangle(texCoord, shape.xy) + shape.z, 0.0, 1.0);\n"
+    "    else if (mode > 2.5)\n"
+    "        t.a = clamp(0.5 - box(texCoord, shape.xy, shape.z), 0.0, 1.0);\n"
+    "    else if (mode > 1.5)\n"
+    "        t = texture2D(Texture, texCoord).bgra;\n"
+    "    else if (mode > 0.5)\n"
+    "        t = vec4(1, 1, 1, texture2D(FontTexture, texCoord).a);\n"
+    "    FragColor = vertexColor * t;\n"
     "}\n";
+    const char * fs[2] = { "#version 120\n#define FragColor gl_FragColor\n", fsBody };
     GLuint fso = glCreateShader(GL_FRAGMENT_SHADER);
 
-    glShaderSource(fso, 1, (const char **) &fs, NULL);
+    glShaderSource(fso, 2, fs, NULL);
     glCompileShader(fso);
-    glAttachShader(state.program, fso2);
+    glAttachShader(state.program, fso);
 
     glGetShaderiv(fso, GL_COMPILE_STATUS, &isCompiled);
     if(isCompiled == GL_FALSE)
@@ -494,32 +1011,12 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
         glDeleteShader(fso); //Don't leak the vso.
     }
 
-    glShaderSource(fso2, 1, (const char **) &fs2, NULL);
-    glCompileShader(fso2);
-    glAttachShader(state.font_program, fso);
-
-    glGetShaderiv(fso2, GL_COMPILE_STATUS, &isCompiled);
-    if(isCompiled == GL_FALSE)
-    {
-        GLint maxLength = 0;
-        glGetShaderiv(fso2, GL_INFO_LOG_LENGTH, &maxLength);
-
-        //The maxLength includes the NULL character
-        char* errorLog = new char[maxLength];
-        glGetShaderInfoLog(fso2, maxLength, &maxLength, errorLog);
-        printf("%s\n", errorLog);
-
-        //Provide the infolog in whatever manor you deem best.
-        //Exit with failure.
-        glDeleteShader(fso2); //Don't leak the vso.
-    }
-
     glBindAttribLocation(state.program,  0,  "VertexPosition");
     glBindAttribLocation(state.program,  1,  "VertexTexCoord");
     glBindAttribLocation(state.program,  2,  "VertexColor");
-    glBindAttribLocation(state.font_program,  0,  "VertexPosition");
-    glBindAttribLocation(state.font_program,  1,  "VertexTexCoord");
-    glBindAttribLocation(state.font_program,  2,  "VertexColor");
+    glBindAttribLocation(state.program,  3,  "VertexMode");
+    glBindAttribLocation(state.program,  4,  "VertexClip");
+    glBindAttribLocation(state.program,  5,  "VertexShape");
 
     glLinkProgram(state.program);
     GLint isLinked = 0;
@@ -535,28 +1032,24 @@ bool ImguiRenderGL3::init(const std::string& fontpath)
         printf("%s\n", infoLog);
     }
 
-    glLinkProgram(state.font_program);
-    glGetProgramiv(state.font_program, GL_LINK_STATUS, (int *)&isLinked);
-    if(isLinked == GL_FALSE)
-    {
-        GLint maxLength = 0;
-        glGetProgramiv(state.font_program, GL_INFO_LOG_LENGTH, &maxLength);
-
-        //The maxLength includes the NULL character
-        char* infoLog = new char[maxLength];
-        glGetProgramInfoLog(state.font_program, maxLength, &maxLength, infoLog);
-        printf("%s\n", infoLog);
-    }
-
     glDeleteShader(vso);
     glDeleteShader(fso);
-    glDeleteShader(fso2);
 
     state.programViewportLocation = glGetUniformLocation(state.program, "Viewport");
+    state.programFontTextureLocation = glGetUniformLocation(state.program, "FontTexture");
     state.programTextureLocation = glGetUniformLocation(state.program, "Texture");
+    state.programClipsLocation = glGetUniformLocation(state.program, "Clips");
+    glUseProgram(state.program);
+    glUniform1i(state.programFontTextureLocation, 0);
+    glUniform1i(state.programTextureLocation, 1);
+    glUseProgram(0);
 
-    state.font_programViewportLocation = glGetUniformLocation(state.font_program, "Viewport");
-    state.font_programTextureLocation = glGetUniformLocation(state.font_program, "Texture");
+    // Without it vertexPulling falls back to tessellating on the CPU.
+    if (GLEW_VERSION_4_3)
+    {
+        initPulling(fsBody);
+    }
+    state.gl.invalidate(false);
 
     free(ttfBuffer);
     free(bmap);
@@ -568,15 +1061,25 @@ ImguiRenderGL3::ImguiRenderGL3(ImguiRenderGL3&& in) noexcept
 {
     state = std::move(in.state);
     initialized = in.initialized;
+    stats = in.stats;
+    sdfShapes = in.sdfShapes;
+    vertexPulling = in.vertexPulling;
+    msaa = in.msaa;
     in.state = RenderState();
     in.initialized = false;
+    in.stats = RenderStats();
 }
 ImguiRenderGL3& ImguiRenderGL3::operator=(ImguiRenderGL3&& in) noexcept
 {
     state = std::move(in.state);
     initialized = in.initialized;
+    stats = in.stats;
+    sdfShapes = in.sdfShapes;
+    vertexPulling = in.vertexPulling;
+    msaa = in.msaa;
     in.state = RenderState();
     in.initialized = false;
+    in.stats = RenderStats();
     return *this;
 }
 
@@ -599,22 +1102,40 @@ void ImguiRenderGL3::destroy()
         glDeleteVertexArrays(1, &state.vao);
         state.vao = 0;
     }
-    if (state.vbos[0])
+    if (state.vbo)
+    {
+        glDeleteBuffers(1, &state.vbo);
+        state.vbo = 0;
+    }
+    if (state.ibo)
     {
-        glDeleteBuffers(3, state.vbos);
+        glDeleteBuffers(1, &state.ibo);
+        state.ibo = 0;
     }
+    destroyRing();
 
     if (state.program)
     {
         glDeleteProgram(state.program);
         state.program = 0;
     }
-
-    if (state.font_program)
+    if (state.pullProgram)
     {
-        glDeleteProgram(state.font_program);
-        state.font_program = 0;
+        glDeleteProgram(state.pullProgram);
+        glDeleteVertexArrays(1, &state.pullVao);
+        const GLuint buffers[6] = { state.commandBuffer, state.arenaBuffer, state.glyphBuffer,
+                                    state.instanceBuffer, state.indirectBuffer, state.textBuffer };
+        glDeleteBuffers(6, buffers);
+        state.pullProgram = 0;
+        state.instanceCount = 0;
     }
+    // A new program starts without its Viewport uniform.
+    state.viewportSize[0] = state.viewportSize[1] = 0;
+
+    // The buffers the last stream was uploaded to are gone.
+    state.streamValid = false;
+    state.streamHash = 0;
+    state.streamCommands = 0;
 }
 
 void ImguiRenderGL3:: getBakedQuad(stbtt_bakedchar *chardata, int pw, int ph, int char_index, float *xpos, float *ypos, stbtt_aligned_quad *q, float scale)
@@ -637,11 +1158,11 @@ void ImguiRenderGL3:: getBakedQuad(stbtt_bakedchar *chardata, int pw, int ph, in
 }
 
 static const float tabStops[4] = {150, 210, 270, 330};
-static float getTextLength(stbtt_bakedchar *chardata, const char* text, float scale)
+static float getTextLength(stbtt_bakedchar *chardata, const char* text, unsigned length, float scale)
 {
     float xpos = 0;
     float len = 0;
-    while (*text)
+    for (const char* end = text + length; text != end; )
     {
         int c = (unsigned char)*text;
         if (c == '\t')
@@ -667,38 +1188,71 @@ static float getTextLength(stbtt_bakedchar *chardata, const char* text, float sc
     return len * scale;
 }
 
-void ImguiRenderGL3:: drawText(float x, float y, const std::string& textin, int align, uint32_t col, float pointSize)
+void ImguiRenderGL3:: drawText(float x, float y, const char* text, unsigned length, int align, uint32_t col, float pointSize, const gfxBox* clip)
 {
     if (!state.ftex) return;
-    if (textin.length() == 0) return;
-
-    const char* text = textin.c_str();
-
-    glUseProgram(state.font_program);
-    glActiveTexture(GL_TEXTURE0);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
+    if (length == 0) return;
 
     float scale = pointSize / 8.f;
 
     if (align == ALIGN_CENTER)
-        x -= getTextLength(state.cdata, text, scale)/2;
+        x -= getTextLength(state.cdata, text, length, scale)/2;
     else if (align == ALIGN_RIGHT)
-        x -= getTextLength(state.cdata, text, scale);
-
-    float r = (float) (col&0xff) / 255.f;
-    float g = (float) ((col>>8)&0xff) / 255.f;
-    float b = (float) ((col>>16)&0xff) / 255.f;
-    float a = (float) ((col>>24)&0xff) / 255.f;
-
-    // assume orthographic projection with units = screen pixels, origin at top left
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, state.ftex);
+        x -= getTextLength(state.cdata, text, length, scale);
 
     const float ox = x;
 
-    while (*text)
+    // With a clip rect the run ends where no later glyph can start left of
+    // its right edge; the pen only moves right.
+    if (clip)
+    {
+        float pen = x;
+        for (unsigned i = 0; i < length; ++i)
+        {
+            if (floorf(pen + state.fontMinXOff * scale) >= clip->x1)
+            {
+                length = i;
+                break;
+            }
+            int c = (unsigned char)text[i];
+            if (c == '\t')
+            {
+                for (int t = 0; t < 4; ++t)
+                {
+                    if (pen < tabStops[t]+ox)
+                    {
+                        pen = tabStops[t]+ox;
+                        break;
+                    }
+                }
+            }
+            else if (c >= 32 && c < 128)
+            {
+                pen += state.cdata[c-32].xadvance * scale;
+            }
+        }
+    }
+
+    // Glyphs without pixels, such as space, only advance the pen; the
+    // others are counted so the run is appended to the stream in one piece.
+    unsigned glyphs = 0;
+    for (unsigned i = 0; i < length; ++i)
+    {
+        int c = (unsigned char)text[i];
+        if (c >= 32 && c < 128 && state.cdata[c-32].x1 > state.cdata[c-32].x0)
+        {
+            ++glyphs;
+        }
+    }
+    if (glyphs == 0) return;
+
+    // assume orthographic projection with units = screen pixels, origin at top left
+    const uint32_t first = allocVertices(glyphs * 4);
+    uint32_t base = first;
+    Vertex* v = state.stream.vertices + base;
+    uint32_t* idx = allocIndices(glyphs * 6);
+
+    for (const char* end = text + length; text != end; )
     {
         int c = (unsigned char)*text;
         if (c == '\t')
@@ -716,97 +1270,249 @@ void ImguiRenderGL3:: drawText(float x, float y, const std::string& textin, int
         {
             stbtt_aligned_quad q;
             getBakedQuad(state.cdata, 512,512, c-32, &x,&y,&q, scale);
-
-            float v[12] = {
-                    q.x0, q.y0,
-                    q.x1, q.y1,
-                    q.x1, q.y0,
-                    q.x0, q.y0,
-                    q.x0, q.y1,
-                    q.x1, q.y1,
-                      };
-            float uv[12] = {
-                    q.s0, q.t0,
-                    q.s1, q.t1,
-                    q.s1, q.t0,
-                    q.s0, q.t0,
-                    q.s0, q.t1,
-                    q.s1, q.t1,
-                      };
-            float c[24] = {
-                    r, g, b, a,
-                    r, g, b, a,
-                    r, g, b, a,
-                    r, g, b, a,
-                    r, g, b, a,
-                    r, g, b, a,
-                      };
-
-
-            if (GLEW_ARB_vertex_array_object)
+            if (q.x1 > q.x0 && (!clip || (q.x1 > clip->x0 && q.x0 < clip->x1)))
             {
-                glBindVertexArray(state.vao);
+                const uint16_t* uv = state.glyphUV[c-32];
+                const uint8_t clipIndex = state.nextClip;
+                v[0] = { q.x0, q.y0, uv[0], uv[1], col, VERTEX_FONT, clipIndex, {0, 0, 0} };
+                v[1] = { q.x1, q.y1, uv[2], uv[3], col, VERTEX_FONT, clipIndex, {0, 0, 0} };
+                v[2] = { q.x1, q.y0, uv[2], uv[1], col, VERTEX_FONT, clipIndex, {0, 0, 0} };
+                v[3] = { q.x0, q.y1, uv[0], uv[3], col, VERTEX_FONT, clipIndex, {0, 0, 0} };
+                idx[0] = base + 0;
+                idx[1] = base + 1;
+                idx[2] = base + 2;
+                idx[3] = base + 0;
+                idx[4] = base + 3;
+                idx[5] = base + 1;
+                v += 4;
+                idx += 6;
+                base += 4;
             }
-            else
+        }
+        ++text;
+    }
+
+    // Give back the space of glyphs left of the clip rect.
+    const unsigned unused = glyphs - (base - first) / 4;
+    if (unused)
+    {
+        freeTail(unused * 4, unused * 6);
+    }
+}
+
+
+static bool overlaps(const gfxBox& a, const gfxBox& b)
+{
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+// Commands with the same key can share a draw call: solid shapes and text
+// go with anything, textured rects need their texture bound.
+static uint64_t pipelineKey(const gfxCmd& cmd)
+{
+    if (cmd.type == GFXCMD_TEXTURED_RECT)
+    {
+        return ((uint64_t)cmd.texturedRect.texture << 1) | 1;
+    }
+    return 0;
+}
+
+gfxBox ImguiRenderGL3::commandBounds(const gfxCmd& cmd, const char* arena)
+{
+    if (cmd.type != GFXCMD_TEXT)
+    {
+        return gfxCmdBounds(cmd, arena);
+    }
+
+    const float scale = cmd.text.pointSize / 100.f / 8.f;
+    const float len = getTextLength(state.cdata, arena + cmd.text.offset, cmd.text.length, scale);
+    gfxBox b;
+    b.x0 = cmd.text.align == ALIGN_LEFT ? cmd.text.x :
+           cmd.text.align == ALIGN_CENTER ? cmd.text.x - len/2 : cmd.text.x - len;
+    b.x1 = b.x0 + len;
+    b.y0 = cmd.text.y - state.fontDescent * scale;
+    b.y1 = cmd.text.y + state.fontAscent * scale;
+    // Glyph quads are snapped to whole pixels.
+    b.x0 -= 1;
+    b.y0 -= 1;
+    b.x1 += 1;
+    b.y1 += 1;
+    return b;
+}
+
+static const unsigned SORT_LOOKBACK = 16;
+
+// Groups the commands of one scissor segment into batches of equal pipeline
+// key. A command joins the earliest batch of its key that comes after every
+// batch it overlaps, so overlapping commands keep their painter's order.
+// Only the last SORT_LOOKBACK batches are searched; older ones are treated
+// as overlapping.
+void ImguiRenderGL3::sortSegment(const gfxCmd* q, const char* arena, uint32_t begin, uint32_t end)
+{
+    std::vector<RenderBatch>& batches = state.batches;
+    std::vector<uint32_t>& cmdBatch = state.cmdBatch;
+    batches.clear();
+    cmdBatch.clear();
+
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        const gfxBox b = commandBounds(q[i], arena);
+        const uint64_t key = pipelineKey(q[i]);
+
+        size_t first = batches.size() > SORT_LOOKBACK ? batches.size() - SORT_LOOKBACK : 0;
+        for (size_t j = batches.size(); j-- > first; )
+        {
+            if (overlaps(batches[j].bounds, b))
             {
-                glEnableVertexAttribArray(0);
-                glEnableVertexAttribArray(1);
-                glEnableVertexAttribArray(2);
+                first = batches[j].key == key ? j : j + 1;
+                break;
             }
+        }
 
-            glBindBuffer(GL_ARRAY_BUFFER, state.vbos[0]);
-            glBufferData(GL_ARRAY_BUFFER, 12*sizeof(float), v, GL_STREAM_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, state.vbos[1]);
-            glBufferData(GL_ARRAY_BUFFER, 12*sizeof(float), uv, GL_STREAM_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, state.vbos[2]);
-            glBufferData(GL_ARRAY_BUFFER, 24*sizeof(float), c, GL_STREAM_DRAW);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        size_t target = first;
+        while (target < batches.size() && batches[target].key != key)
+        {
+            ++target;
         }
-        ++text;
+        if (target == batches.size())
+        {
+            batches.push_back({ key, b, 0 });
+        }
+        RenderBatch& batch = batches[target];
+        batch.bounds.x0 = std::min(batch.bounds.x0, b.x0);
+        batch.bounds.y0 = std::min(batch.bounds.y0, b.y0);
+        batch.bounds.x1 = std::max(batch.bounds.x1, b.x1);
+        batch.bounds.y1 = std::max(batch.bounds.y1, b.y1);
+        batch.count++;
+        cmdBatch.push_back((uint32_t)target);
     }
 
-    //glEnd();
-    //glDisable(GL_TEXTURE_2D);
+    // Stable counting sort of the segment by batch.
+    uint32_t offset = (uint32_t)state.order.size();
+    for (RenderBatch& batch : batches)
+    {
+        uint32_t count = batch.count;
+        batch.count = offset;
+        offset += count;
+    }
+    state.order.resize(offset);
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        state.order[batches[cmdBatch[i - begin]].count++] = i;
+    }
+}
 
-    glUseProgram(state.program);
-    glActiveTexture(GL_TEXTURE0);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
+void ImguiRenderGL3::sortCommands(const gfxCmdQueue& queue)
+{
+    state.order.clear();
+
+    for (unsigned layer = 0; layer < LAYER_COUNT; ++layer)
+    {
+        state.layerOrder[layer] = (uint32_t)state.order.size();
+
+        const gfxCmd* q = queue.layers[layer].data();
+        const uint32_t n = (uint32_t)queue.layers[layer].size();
+        for (uint32_t begin = 0; begin < n; )
+        {
+            uint32_t end = begin;
+            while (end < n && q[end].type != GFXCMD_SCISSOR)
+            {
+                ++end;
+            }
+            sortSegment(q, queue.arena.data(), begin, end);
+            if (end < n)
+            {
+                state.order.push_back(end);
+            }
+            begin = end + 1;
+        }
+    }
+    state.layerOrder[LAYER_COUNT] = (uint32_t)state.order.size();
 }
 
+static bool intersects(const gfxBox& b, const gfxDamageRect& r)
+{
+    return b.x0 < r.x + r.w && b.x1 > r.x && b.y0 < r.y + r.h && b.y1 > r.y;
+}
 
-void ImguiRenderGL3::draw(Imgui& imgui, int width, int height)
+// Makes vertices appended from now on clip to the given rect.
+void ImguiRenderGL3::addClip(const gfxBox& b)
 {
-    auto q = imgui.renderQueue;
-    int nq = q.size();
+    const size_t n = state.clips.size() / 4;
+    state.next.clipSet = (uint32_t)(n / MAX_CLIPS);
+    state.nextClip = (uint8_t)(n % MAX_CLIPS + 1);
+    state.clips.push_back(b.x0);
+    state.clips.push_back(b.y0);
+    state.clips.push_back(b.x1);
+    state.clips.push_back(b.y1);
+}
 
-    const float s = 1.0f/8.0f;
+// Clips to the damage rect only, or disables clipping for a full redraw.
+void ImguiRenderGL3::resetScissor(const gfxDamageRect* damage)
+{
+    state.nextClip = 0;
+    state.next.scissor = damage != nullptr;
+    if (damage)
+    {
+        state.next.clip[0] = damage->x;
+        state.next.clip[1] = damage->y;
+        state.next.clip[2] = damage->w;
+        state.next.clip[3] = damage->h;
+    }
+}
 
-    glViewport(0, 0, width, height);
-    glUseProgram(state.program);
-    glActiveTexture(GL_TEXTURE0);
-    glUniform2f(state.programViewportLocation, (float) width, (float) height);
-    glUniform1i(state.programTextureLocation, 0);
-    glUseProgram(state.font_program);
-    glUniform2f(state.font_programViewportLocation, (float) width, (float) height);
-    glUniform1i(state.font_programTextureLocation, 0);
-    glUseProgram(state.program);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[0]);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*2, (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[1]);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*2, (void*)0);
-    glBindBuffer(GL_ARRAY_BUFFER, state.vbos[2]);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT)*4, (void*)0);
+void ImguiRenderGL3::tessellateCommands(const gfxCmdQueue& queue, const gfxDamageRect* damage)
+{
+    uint32_t nq = (uint32_t)state.order.size();
+    const char* arena = queue.arena.data();
+
+    const float s = 1.0f/8.0f;
 
-    glDisable(GL_SCISSOR_TEST);
-    for (int i = 0; i < nq; ++i)
+    uint64_t key = 0;
+    resetScissor(damage);
+    gfxBox clip = {0, 0, 0, 0};
+    unsigned layer = 0;
+    for (uint32_t i = 0; i < nq; ++i)
     {
-        const gfxCmd& cmd = q[i];
-        if (cmd.type == GFXCMD_RECT)
+        // Scissors do not carry over from one layer to the next.
+        if (i == state.layerOrder[layer + 1])
+        {
+            while (i == state.layerOrder[layer + 1])
+            {
+                ++layer;
+            }
+            resetScissor(damage);
+        }
+
+        const gfxCmd& cmd = queue.layers[layer][state.order[i]];
+        if (cmd.type != GFXCMD_SCISSOR)
+        {
+            const gfxBox b = commandBounds(cmd, arena);
+            if (damage && !intersects(b, *damage))
+            {
+                continue;
+            }
+            if (state.nextClip && !overlaps(b, clip))
+            {
+                continue;
+            }
+        }
+
+        if (cmd.type != GFXCMD_SCISSOR && pipelineKey(cmd) != key)
+        {
+            key = pipelineKey(cmd);
+            stats.stateChanges++;
+        }
+        if (cmd.type != GFXCMD_SCISSOR)
+        {
+            stats.commands++;
+        }
+
+        if (sdfShapes && (cmd.type == GFXCMD_RECT || cmd.type == GFXCMD_LINE || cmd.type == GFXCMD_TRIANGLE))
+        {
+            drawShape(cmd);
+        }
+        else if (cmd.type == GFXCMD_RECT)
         {
             if (cmd.rect.r == 0)
             {
@@ -816,18 +1522,19 @@ void ImguiRenderGL3::draw(Imgui& imgui, int width, int height)
             }
             else
             {
-                drawRoundedRect((float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f,
+                drawCachedShape(TESS_ROUNDED_RECT, (float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f,
                                 (float)cmd.rect.w*s-1, (float)cmd.rect.h*s-1,
                                 (float)cmd.rect.r*s, 1.0f, cmd.col);
             }
         }
         else if (cmd.type == GFXCMD_TEXTURED_RECT)
         {
-            drawTexturedRect((float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f,
-                     (float)cmd.rect.w*s-1, (float)cmd.rect.h*s-1,
+            float tc[4];
+            memcpy(tc, arena + cmd.texturedRect.texCoords, sizeof(tc));
+            drawTexturedRect((float)cmd.texturedRect.x*s+0.5f, (float)cmd.texturedRect.y*s+0.5f,
+                     (float)cmd.texturedRect.w*s-1, (float)cmd.texturedRect.h*s-1,
                      cmd.texturedRect.texture, cmd.col,
-                     cmd.texturedRect.tx0, cmd.texturedRect.ty0,
-                     cmd.texturedRect.tx1, cmd.texturedRect.ty1);
+                     tc[0], tc[1], tc[2], tc[3]);
         }
         else if (cmd.type == GFXCMD_LINE)
         {
@@ -835,48 +1542,862 @@ void ImguiRenderGL3::draw(Imgui& imgui, int width, int height)
         }
         else if (cmd.type == GFXCMD_TRIANGLE)
         {
-            if (cmd.flags == 1)
-            {
-                const float verts[3*2] =
-                {
-                    (float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f,
-                    (float)cmd.rect.x*s+0.5f+(float)cmd.rect.w*s-1, (float)cmd.rect.y*s+0.5f+(float)cmd.rect.h*s/2-0.5f,
-                    (float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f+(float)cmd.rect.h*s-1,
-                };
-                drawPolygon(verts, 3, 1.0f, cmd.col);
-            }
-            if (cmd.flags == 2)
+            if (cmd.flags == 1 || cmd.flags == 2)
             {
-                const float verts[3*2] =
-                {
-                    (float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f+(float)cmd.rect.h*s-1,
-                    (float)cmd.rect.x*s+0.5f+(float)cmd.rect.w*s/2-0.5f, (float)cmd.rect.y*s+0.5f,
-                    (float)cmd.rect.x*s+0.5f+(float)cmd.rect.w*s-1, (float)cmd.rect.y*s+0.5f+(float)cmd.rect.h*s-1,
-                };
-                drawPolygon(verts, 3, 1.0f, cmd.col);
+                drawCachedShape(cmd.flags == 1 ? TESS_TRIANGLE_RIGHT : TESS_TRIANGLE_DOWN,
+                                (float)cmd.rect.x*s+0.5f, (float)cmd.rect.y*s+0.5f,
+                                (float)cmd.rect.w*s-1, (float)cmd.rect.h*s-1,
+                                0, 1.0f, cmd.col);
             }
         }
         else if (cmd.type == GFXCMD_TEXT)
         {
-            drawText(cmd.text.x, cmd.text.y, cmd.text.text, cmd.text.align, cmd.col, ((float)cmd.text.pointSize) / 100.f);
+            // Glyphs outside the clip and damage rects are left out.
+            gfxBox visible = { -1e10f, -1e10f, 1e10f, 1e10f };
+            if (state.nextClip)
+            {
+                visible = clip;
+            }
+            if (damage)
+            {
+                visible.x0 = std::max(visible.x0, (float)damage->x);
+                visible.y0 = std::max(visible.y0, (float)damage->y);
+                visible.x1 = std::min(visible.x1, (float)(damage->x + damage->w));
+                visible.y1 = std::min(visible.y1, (float)(damage->y + damage->h));
+            }
+            drawText(cmd.text.x, cmd.text.y, arena + cmd.text.offset, cmd.text.length, cmd.text.align, cmd.col, ((float)cmd.text.pointSize) / 100.f,
+                     state.nextClip || damage ? &visible : nullptr);
         }
         else if (cmd.type == GFXCMD_SCISSOR)
         {
+            // Clip rects go to the shader per vertex; glScissor is only
+            // used for the damage rect.
             if (cmd.flags)
             {
-                glEnable(GL_SCISSOR_TEST);
-                glScissor(cmd.rect.x, cmd.rect.y, cmd.rect.w, cmd.rect.h);
+                clip = { (float)cmd.rect.x, (float)cmd.rect.y,
+                         (float)(cmd.rect.x + cmd.rect.w), (float)(cmd.rect.y + cmd.rect.h) };
+                addClip(clip);
             }
             else
             {
-                glDisable(GL_SCISSOR_TEST);
+                state.nextClip = 0;
             }
         }
     }
-    glDisable(GL_SCISSOR_TEST);
+}
+
+void GLStateCache::invalidate(bool keepVertexArrayState)
+{
+    program = UNKNOWN;
+    activeUnit = UNKNOWN;
+    textures[0] = textures[1] = UNKNOWN;
+    vertexArray = UNKNOWN;
+    arrayBuffer = UNKNOWN;
+    scissorTest = -1;
+    scissorValid = false;
+    viewportValid = false;
+    if (!keepVertexArrayState)
+    {
+        elementBuffer = UNKNOWN;
+        for (int& a : attribs)
+        {
+            a = -1;
+        }
+        formatBuffer = UNKNOWN;
+    }
+}
+
+// Counts calls as issued or elided and returns whether they must be made.
+bool GLStateCache::changed(bool differs, unsigned calls)
+{
+    (differs ? issued : elided) += calls;
+    return differs;
+}
+
+void GLStateCache::useProgram(GLuint p)
+{
+    if (changed(program != p))
+    {
+        program = p;
+        glUseProgram(p);
+    }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLuint texture)
+{
+    if (textures[unit] == texture)
+    {
+        changed(false);
+        return;
+    }
+    if (changed(activeUnit != unit))
+    {
+        activeUnit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    changed(true);
+    textures[unit] = texture;
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+    if (changed(vertexArray != vao))
+    {
+        vertexArray = vao;
+        glBindVertexArray(vao);
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& bound = target == GL_ELEMENT_ARRAY_BUFFER ? elementBuffer : arrayBuffer;
+    if (changed(bound != buffer))
+    {
+        bound = buffer;
+        glBindBuffer(target, buffer);
+    }
+}
+
+void GLStateCache::enableAttrib(GLuint index, bool enable)
+{
+    if (changed(attribs[index] != (int)enable))
+    {
+        attribs[index] = enable;
+        if (enable)
+        {
+            glEnableVertexAttribArray(index);
+        }
+        else
+        {
+            glDisableVertexAttribArray(index);
+        }
+    }
+}
+
+void GLStateCache::enableScissor(bool enable)
+{
+    if (changed(scissorTest != (int)enable))
+    {
+        scissorTest = enable;
+        if (enable)
+        {
+            glEnable(GL_SCISSOR_TEST);
+        }
+        else
+        {
+            glDisable(GL_SCISSOR_TEST);
+        }
+    }
+}
+
+void GLStateCache::setScissor(const GLint* rect)
+{
+    if (changed(!scissorValid || memcmp(scissorRect, rect, sizeof(scissorRect)) != 0))
+    {
+        scissorValid = true;
+        memcpy(scissorRect, rect, sizeof(scissorRect));
+        glScissor(rect[0], rect[1], rect[2], rect[3]);
+    }
+}
+
+void GLStateCache::setViewport(GLint x, GLint y, GLint w, GLint h)
+{
+    const GLint rect[4] = {x, y, w, h};
+    if (changed(!viewportValid || memcmp(viewport, rect, sizeof(viewport)) != 0))
+    {
+        viewportValid = true;
+        memcpy(viewport, rect, sizeof(viewport));
+        glViewport(x, y, w, h);
+    }
+}
+
+bool ImguiRenderGL3::createRing(size_t vertexSize, size_t indexSize)
+{
+    destroyRing();
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const size_t regionSize = vertexSize + indexSize;
+    state.ringRegionSize = regionSize;
+    state.ringVertexSize = vertexSize;
+    glGenBuffers(1, &state.ring);
+    state.gl.bindBuffer(GL_ARRAY_BUFFER, state.ring);
+    glBufferStorage(GL_ARRAY_BUFFER, regionSize * RING_REGIONS, nullptr, flags);
+    state.ringData = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * RING_REGIONS, flags);
+    if (!state.ringData)
+    {
+        destroyRing();
+        return false;
+    }
+    return true;
+}
+
+void ImguiRenderGL3::destroyRing()
+{
+    for (unsigned i = 0; i < RING_REGIONS; ++i)
+    {
+        waitRegion(i);
+    }
+    if (state.ringData)
+    {
+        state.gl.bindBuffer(GL_ARRAY_BUFFER, state.ring);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        state.ringData = nullptr;
+    }
+    if (state.ring)
+    {
+        glDeleteBuffers(1, &state.ring);
+        state.ring = 0;
+        state.gl.invalidate(false);
+    }
+    state.ringRegionSize = 0;
+    state.ringVertexSize = 0;
+}
+
+// Blocks until the GPU has finished reading the given ring region.
+void ImguiRenderGL3::waitRegion(unsigned region)
+{
+    GLsync& fence = state.ringFences[region];
+    if (!fence)
+    {
+        return;
+    }
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+    {
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+// Points the stream at the next ring region, or at vertices and indices.
+void ImguiRenderGL3::beginStream()
+{
+    StreamTarget& stream = state.stream;
+    stream = StreamTarget();
+    state.streamSpilled = false;
+    if (state.useRing)
+    {
+        state.ringRegion = (state.ringRegion + 1) % RING_REGIONS;
+        waitRegion(state.ringRegion);
+        state.vertexOffset = state.ringRegion * state.ringRegionSize;
+        state.indexOffset = state.vertexOffset + state.ringVertexSize;
+        stream.vertices = (Vertex*)(state.ringData + state.vertexOffset);
+        stream.indices = (uint32_t*)(state.ringData + state.indexOffset);
+        stream.vertexCapacity = (uint32_t)(state.ringVertexSize / sizeof(Vertex));
+        stream.indexCapacity = (uint32_t)((state.ringRegionSize - state.ringVertexSize) / sizeof(uint32_t));
+        return;
+    }
+    stream.vertexStore = &state.vertices;
+    stream.indexStore = &state.indices;
+    stream.vertices = state.vertices.data();
+    stream.indices = state.indices.data();
+    stream.vertexCapacity = (uint32_t)state.vertices.size();
+    stream.indexCapacity = (uint32_t)state.indices.size();
+    state.vertexOffset = 0;
+    state.indexOffset = 0;
+}
+
+// Returns false if the stream spilled out of its ring region, after growing
+// the ring so the frame fits when it is tessellated again.
+bool ImguiRenderGL3::uploadStream()
+{
+    const size_t size = state.stream.vertexCount * sizeof(Vertex);
+    const size_t indexSize = state.stream.indexCount * sizeof(uint32_t);
+    if (state.streamSpilled)
+    {
+        // Grow with headroom so a slowly growing UI does not reallocate
+        // every frame.
+        size_t vertexSize = std::max(state.ringVertexSize, (size_t)192 * 1024);
+        size_t ringIndexSize = std::max(state.ringRegionSize - state.ringVertexSize, (size_t)64 * 1024);
+        while (vertexSize < size)
+        {
+            vertexSize *= 2;
+        }
+        while (ringIndexSize < indexSize)
+        {
+            ringIndexSize *= 2;
+        }
+        state.useRing = createRing(vertexSize, ringIndexSize);
+        return false;
+    }
+
+    stats.uploadBytes += (unsigned)(size + indexSize);
+    if (state.useRing)
+    {
+        return true;
+    }
+    state.gl.bindBuffer(GL_ARRAY_BUFFER, state.vbo);
+    glBufferData(GL_ARRAY_BUFFER, size, state.vertices.data(), GL_STREAM_DRAW);
+    state.gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize, state.indices.data(), GL_STREAM_DRAW);
+    return true;
+}
+
+// Attribute layout of Vertex in buffer, starting offset bytes in.
+void ImguiRenderGL3::setVertexFormat(GLuint buffer, size_t offset)
+{
+    GLStateCache& gl = state.gl;
+    if (!gl.changed(gl.formatBuffer != buffer || gl.formatOffset != offset, VERTEX_ATTRIBS))
+    {
+        return;
+    }
+    gl.formatBuffer = buffer;
+    gl.formatOffset = offset;
+    gl.bindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, x)));
+    glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, u)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, col)));
+    glVertexAttribPointer(3, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, mode)));
+    glVertexAttribPointer(4, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, clip)));
+    glVertexAttribPointer(5, 3, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, shape)));
+}
+
+void ImguiRenderGL3::drawStream()
+{
+    uint32_t clipSet = ~0u;
+    for (const DrawCall& dc : state.draws)
+    {
+        const size_t firstClip = (size_t)dc.clipSet * MAX_CLIPS;
+        if (state.gl.changed(dc.clipSet != clipSet) && firstClip * 4 < state.clips.size())
+        {
+            clipSet = dc.clipSet;
+            const size_t count = std::min((size_t)MAX_CLIPS, state.clips.size() / 4 - firstClip);
+            glUniform4fv(state.programClipsLocation, (GLsizei)count, &state.clips[firstClip * 4]);
+        }
+        if (dc.texture)
+        {
+            state.gl.bindTexture(1, dc.texture);
+        }
+        state.gl.enableScissor(dc.scissor);
+        if (dc.scissor)
+        {
+            state.gl.setScissor(dc.clip);
+        }
+        glDrawElements(GL_TRIANGLES, dc.count, GL_UNSIGNED_INT, (void*)(state.indexOffset + dc.first * sizeof(uint32_t)));
+        stats.drawCalls++;
+    }
+}
+
+static GLuint compileShader(GLenum type, const char* const* sources, GLsizei count)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, count, sources, NULL);
+    glCompileShader(shader);
+
+    GLint isCompiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+    if (isCompiled == GL_FALSE)
+    {
+        GLint maxLength = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &maxLength);
+
+        //The maxLength includes the NULL character
+        std::vector<char> errorLog(maxLength + 1);
+        glGetShaderInfoLog(shader, maxLength, &maxLength, errorLog.data());
+        printf("%s\n", errorLog.data());
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
 
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
+// Builds the vertex pulling program and its buffers. Returns false, leaving
+// vertexPulling to fall back to the CPU, if the shaders do not compile.
+bool ImguiRenderGL3::initPulling(const char* fsBody)
+{
+    // Command i is the 8 uints at cmds[i * 8], laid out as gfxCmd, and
+    // drawn as 6 vertices per quad: one quad for shapes and textured rects,
+    // one per glyph for text. The shapes repeat drawShape. Glyphs are laid
+    // out on the CPU by layoutPulledText, and a text draw starts at 6 times
+    // the index of its first glyph in text.
+    const char * vs =
+    "#version 430\n"
+    "layout(std430, binding = 0) readonly buffer Commands { uint cmds[]; };\n"
+    "layout(std430, binding = 1) readonly buffer Arena { uint arena[]; };\n"
+    "layout(std430, binding = 2) readonly buffer Glyphs { vec4 glyphs[]; };\n"
+    "struct PulledGlyph { float x; uint c; };\n"
+    "layout(std430, binding = 3) readonly buffer Text { PulledGlyph text[]; };\n"
+    "uniform vec2 Viewport;\n"
+    "layout(location = 0) in uint CommandIndex;\n"
+    "out vec2 texCoord;\n"
+    "out vec4 vertexColor;\n"
+    "out float mode;\n"
+    "out float clip;\n"
+    "out vec3 shape;\n"
+    "const int corners[6] = int[6](0, 1, 3, 0, 3, 2);\n"
+    "uint base;\n"
+    "float arg(uint i)\n"
+    "{\n"
+    "    return uintBitsToFloat(cmds[base + 2u + i]);\n"
+    "}\n"
+    "vec2 quad(vec2 o, vec2 d, vec4 local, vec3 s, float m, vec2 c)\n"
+    "{\n"
+    "    vec2 l = mix(local.xy, local.zw, c);\n"
+    "    texCoord = l;\n"
+    "    shape = s;\n"
+    "    mode = m;\n"
+    "    return o + d * l.x + vec2(-d.y, d.x) * l.y;\n"
+    "}\n"
+    "void main(void)\n"
+    "{\n"
+    "    base = CommandIndex * 8u;\n"
+    "    uint type = cmds[base] & 255u;\n"
+    "    uint flags = (cmds[base] >> 8) & 255u;\n"
+    "    int corner = corners[gl_VertexID % 6];\n"
+    "    vec2 c = vec2(corner & 1, corner >> 1);\n"
+    "    vertexColor = unpackUnorm4x8(cmds[base + 1u]);\n"
+    "    texCoord = vec2(0.0);\n"
+    "    shape = vec3(0.0);\n"
+    "    mode = 0.0;\n"
+    "    clip = 0.0;\n"
+    "    vec2 pos = vec2(0.0);\n"
+    "    if (type == 0u)\n"
+    "    {\n"
+    "        vec2 size = vec2(arg(2u), arg(3u)) / 8.0;\n"
+    "        float r = arg(4u) == 0.0 ? 0.0 : arg(4u) / 8.0 + 0.5;\n"
+    "        vec2 h = size * 0.5 - (arg(4u) == 0.0 ? 0.5 : 0.0);\n"
+    "        pos = quad(vec2(arg(0u), arg(1u)) / 8.0 + size * 0.5, vec2(1.0, 0.0), vec4(-h - 1.0, h + 1.0),\n"
+    "                   vec3(h, min(r, min(h.x, h.y))), 3.0, c);\n"
+    "    }\n"
+    "    else if (type == 1u)\n"
+    "    {\n"
+    "        vec4 rc = vec4(arg(0u), arg(1u), arg(2u), arg(3u)) / 8.0;\n"
+    "        bool right = flags == 1u;\n"
+    "        float hw = ((right ? rc.w : rc.z) - 1.0) * 0.5;\n"
+    "        float height = (right ? rc.z : rc.w) - 1.0;\n"
+    "        vec2 o = right ? vec2(rc.x + rc.z - 0.5, rc.y + rc.w * 0.5) : vec2(rc.x + rc.z * 0.5, rc.y + 0.5);\n"
+    "        pos = quad(o, right ? vec2(0.0, 1.0) : vec2(1.0, 0.0), vec4(-hw - 1.5, -1.5, hw + 1.5, height + 1.5),\n"
+    "                   vec3(hw, height, 0.5), 4.0, c);\n"
+    "    }\n"
+    "    else if (type == 2u)\n"
+    "    {\n"
+    "        vec2 p0 = vec2(arg(0u), arg(1u)) / 8.0, p1 = vec2(arg(2u), arg(3u)) / 8.0;\n"
+    "        float len = length(p1 - p0);\n"
+    "        vec2 d = len > 0.0001 ? (p1 - p0) / len : vec2(1.0, 0.0);\n"
+    "        float hw = max((arg(4u) / 8.0 - 1.0) * 0.5, 0.01) + 0.5;\n"
+    "        float hx = len * 0.5 + hw;\n"
+    "        pos = quad((p0 + p1) * 0.5, d, vec4(-hx - 1.0, -hw - 1.0, hx + 1.0, hw + 1.0), vec3(hx, hw, 0.0), 3.0, c);\n"
+    "    }\n"
+    "    else if (type == 3u)\n"
+    "    {\n"
+    "        float scale = arg(2u) / 100.0 / 8.0;\n"
+    "        PulledGlyph t = text[gl_VertexID / 6];\n"
+    "        vec4 g = glyphs[(t.c - 32u) * 2u], m = glyphs[(t.c - 32u) * 2u + 1u];\n"
+    "        vec2 p0 = vec2(floor(t.x + m.x * scale), floor(arg(1u) - m.y * scale));\n"
+    "        pos = p0 + vec2(g.z - g.x, g.y - g.w) * scale * c;\n"
+    "        texCoord = mix(g.xy, g.zw, c) / 512.0;\n"
+    "        mode = 1.0;\n"
+    "    }\n"
+    "    else if (type == 5u)\n"
+    "    {\n"
+    "        vec4 rc = vec4(arg(0u), arg(1u), arg(2u), arg(3u)) / 8.0;\n"
+    "        uint t = cmds[base + 7u] >> 2;\n"
+    "        vec4 tc = uintBitsToFloat(uvec4(arena[t], arena[t + 1u], arena[t + 2u], arena[t + 3u]));\n"
+    "        pos = rc.xy + rc.zw * c;\n"
+    "        texCoord = mix(tc.xy, tc.zw, (rc.zw * c + 0.5) / (rc.zw + 1.0));\n"
+    "        mode = 2.0;\n"
+    "    }\n"
+    "    gl_Position = vec4(pos * 2.0 / Viewport - 1.0, 0.0, 1.0);\n"
+    "}\n";
+    const char * fs[2] = { "#version 430\n#define varying in\n#define texture2D texture\nout vec4 FragColor;\n", fsBody };
+
+    GLuint vso = compileShader(GL_VERTEX_SHADER, &vs, 1);
+    GLuint fso = compileShader(GL_FRAGMENT_SHADER, fs, 2);
+    GLuint program = 0;
+    if (vso && fso)
+    {
+        program = glCreateProgram();
+        glAttachShader(program, vso);
+        glAttachShader(program, fso);
+        glLinkProgram(program);
+
+        GLint isLinked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+        if (isLinked == GL_FALSE)
+        {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    glDeleteShader(vso);
+    glDeleteShader(fso);
+    if (!program)
+    {
+        return false;
+    }
+
+    state.pullProgram = program;
+    state.pullViewportLocation = glGetUniformLocation(program, "Viewport");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "FontTexture"), 0);
+    glUniform1i(glGetUniformLocation(program, "Texture"), 1);
     glUseProgram(0);
+
+    float glyphs[96][8];
+    for (int i = 0; i < 96; ++i)
+    {
+        const stbtt_bakedchar& b = state.cdata[i];
+        const float g[8] = { (float)b.x0, (float)b.y0, (float)b.x1, (float)b.y1, b.xoff, b.yoff, b.xadvance, 0 };
+        memcpy(glyphs[i], g, sizeof(g));
+    }
+    glGenBuffers(1, &state.glyphBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.glyphBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glyphs), glyphs, GL_STATIC_DRAW);
+    glGenBuffers(1, &state.commandBuffer);
+    glGenBuffers(1, &state.arenaBuffer);
+    glGenBuffers(1, &state.instanceBuffer);
+    glGenBuffers(1, &state.indirectBuffer);
+    glGenBuffers(1, &state.textBuffer);
+
+    glGenVertexArrays(1, &state.pullVao);
+    glBindVertexArray(state.pullVao);
+    glBindBuffer(GL_ARRAY_BUFFER, state.instanceBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(0, 1);
+    glBindVertexArray(0);
+    return true;
+}
+
+// Appends the glyphs of a text command to pulledGlyphs, placed as drawText
+// places them, so the shader reads each pen x instead of walking the run.
+void ImguiRenderGL3::layoutPulledText(const gfxText& text, const char* arena, const gfxBox* clip)
+{
+    const char* chars = arena + text.offset;
+    const float scale = text.pointSize / 100.0f / 8.0f;
+    float x = text.x;
+    if (text.align == ALIGN_CENTER)
+        x -= getTextLength(state.cdata, chars, text.length, scale)/2;
+    else if (text.align == ALIGN_RIGHT)
+        x -= getTextLength(state.cdata, chars, text.length, scale);
+
+    const float ox = x;
+    for (unsigned i = 0; i < text.length; ++i)
+    {
+        // As in drawText, the pen only moves right.
+        if (clip && floorf(x + state.fontMinXOff * scale) >= clip->x1)
+        {
+            break;
+        }
+        int c = (unsigned char)chars[i];
+        if (c == '\t')
+        {
+            for (int t = 0; t < 4; ++t)
+            {
+                if (x < tabStops[t]+ox)
+                {
+                    x = tabStops[t]+ox;
+                    break;
+                }
+            }
+        }
+        else if (c >= 32 && c < 128)
+        {
+            const stbtt_bakedchar& b = state.cdata[c-32];
+            const float x0 = floorf(x + b.xoff * scale);
+            const float x1 = x0 + (b.x1 - b.x0) * scale;
+            if (x1 > x0 && (!clip || (x1 > clip->x0 && x0 < clip->x1)))
+            {
+                state.pulledGlyphs.push_back({ x, (uint32_t)c });
+            }
+            x += b.xadvance * scale;
+        }
+    }
+}
+
+// Builds one indirect draw per drawn command, in the order sortCommands
+// chose, and groups them into state.draws.
+void ImguiRenderGL3::buildPulledDraws(const gfxCmdQueue& queue)
+{
+    uint32_t layerBase[LAYER_COUNT];
+    uint32_t total = 0;
+    for (unsigned layer = 0; layer < LAYER_COUNT; ++layer)
+    {
+        layerBase[layer] = total;
+        total += (uint32_t)queue.layers[layer].size();
+    }
+
+    state.indirect.clear();
+    state.pulledGlyphs.clear();
+    state.draws.clear();
+    state.next = DrawCall();
+    gfxBox clip = {0, 0, 0, 0};
+    uint64_t key = 0;
+    unsigned layer = 0;
+    for (uint32_t i = 0; i < (uint32_t)state.order.size(); ++i)
+    {
+        // Scissors do not carry over from one layer to the next.
+        if (i == state.layerOrder[layer + 1])
+        {
+            while (i == state.layerOrder[layer + 1])
+            {
+                ++layer;
+            }
+            state.next.scissor = false;
+        }
+
+        const gfxCmd& cmd = queue.layers[layer][state.order[i]];
+        if (cmd.type == GFXCMD_SCISSOR)
+        {
+            state.next.scissor = cmd.flags != 0;
+            state.next.clip[0] = (GLint)cmd.rect.x;
+            state.next.clip[1] = (GLint)cmd.rect.y;
+            state.next.clip[2] = (GLint)cmd.rect.w;
+            state.next.clip[3] = (GLint)cmd.rect.h;
+            clip = { (float)cmd.rect.x, (float)cmd.rect.y,
+                     (float)(cmd.rect.x + cmd.rect.w), (float)(cmd.rect.y + cmd.rect.h) };
+            continue;
+        }
+        if (state.next.scissor && !overlaps(commandBounds(cmd, queue.arena.data()), clip))
+        {
+            continue;
+        }
+
+        uint32_t count = 6;
+        uint32_t first = 0;
+        if (cmd.type == GFXCMD_TEXT)
+        {
+            first = 6 * (uint32_t)state.pulledGlyphs.size();
+            layoutPulledText(cmd.text, queue.arena.data(), state.next.scissor ? &clip : nullptr);
+            count = 6 * (uint32_t)state.pulledGlyphs.size() - first;
+        }
+        else if (cmd.type == GFXCMD_TRIANGLE && cmd.flags != 1 && cmd.flags != 2)
+        {
+            count = 0;
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        if (pipelineKey(cmd) != key)
+        {
+            key = pipelineKey(cmd);
+            stats.stateChanges++;
+        }
+        stats.commands++;
+        stats.vertices += count;
+
+        if (cmd.type == GFXCMD_TEXTURED_RECT)
+        {
+            state.next.texture = cmd.texturedRect.texture;
+        }
+        if (state.draws.empty() || !sameDrawState(state.draws.back(), state.next))
+        {
+            state.draws.push_back(state.next);
+            state.draws.back().first = (uint32_t)state.indirect.size();
+            state.draws.back().count = 0;
+        }
+        state.draws.back().count++;
+        state.indirect.push_back({ count, 1, first, layerBase[layer] + state.order[i] });
+    }
+}
+
+void ImguiRenderGL3::uploadPulled(const gfxCmdQueue& queue)
+{
+    // The layers go one after the other, matching layerBase above.
+    const size_t total = queue.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(total, (size_t)1) * sizeof(gfxCmd), nullptr, GL_STREAM_DRAW);
+    size_t offset = 0;
+    for (const std::vector<gfxCmd>& cmds : queue.layers)
+    {
+        if (!cmds.empty())
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, cmds.size() * sizeof(gfxCmd), cmds.data());
+            offset += cmds.size() * sizeof(gfxCmd);
+        }
+    }
+
+    // The shader reads the arena as whole uints.
+    const size_t arenaSize = queue.arena.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.arenaBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max((arenaSize + 3) & ~(size_t)3, (size_t)4), nullptr, GL_STREAM_DRAW);
+    if (arenaSize)
+    {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, arenaSize, queue.arena.data());
+    }
+
+    const size_t textSize = state.pulledGlyphs.size() * sizeof(PulledGlyph);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.textBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(textSize, sizeof(PulledGlyph)), nullptr, GL_STREAM_DRAW);
+    if (textSize)
+    {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, textSize, state.pulledGlyphs.data());
+    }
+
+    const size_t indirectSize = state.indirect.size() * sizeof(IndirectDraw);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, state.indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectSize, state.indirect.data(), GL_STREAM_DRAW);
+    stats.uploadBytes += (unsigned)(offset + arenaSize + textSize + indirectSize);
+
+    if (total > state.instanceCount)
+    {
+        state.instanceCount = std::max(total, state.instanceCount * 2);
+        std::vector<uint32_t> instances(state.instanceCount);
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            instances[i] = (uint32_t)i;
+        }
+        state.gl.bindBuffer(GL_ARRAY_BUFFER, state.instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(uint32_t), instances.data(), GL_STATIC_DRAW);
+        stats.uploadBytes += (unsigned)(instances.size() * sizeof(uint32_t));
+    }
+}
+
+void ImguiRenderGL3::drawPulled(const gfxCmdQueue& queue, int width, int height)
+{
+    GLStateCache& gl = state.gl;
+    gl.useProgram(state.pullProgram);
+    glUniform2f(state.pullViewportLocation, (float) width, (float) height);
+    gl.bindTexture(0, state.ftex);
+    gl.bindVertexArray(state.pullVao);
+
+    // As with the tessellated stream, unchanged frames are not uploaded.
+    stats.drawCalls = 0;
+    stats.uploadBytes = 0;
+    if (!queue.unchanged || !state.streamValid || !state.streamPulled ||
+        queue.hash != state.streamHash || queue.size() != state.streamCommands)
+    {
+        stats = RenderStats();
+        sortCommands(queue);
+        buildPulledDraws(queue);
+        uploadPulled(queue);
+        state.streamValid = true;
+        state.streamPulled = true;
+        state.streamHash = queue.hash;
+        state.streamCommands = queue.size();
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, state.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, state.arenaBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, state.glyphBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, state.textBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, state.indirectBuffer);
+    for (const DrawCall& dc : state.draws)
+    {
+        if (dc.texture)
+        {
+            gl.bindTexture(1, dc.texture);
+        }
+        gl.enableScissor(dc.scissor);
+        if (dc.scissor)
+        {
+            gl.setScissor(dc.clip);
+        }
+        glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)(dc.first * sizeof(IndirectDraw)), dc.count, 0);
+        stats.drawCalls++;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void ImguiRenderGL3::drawTessellated(const gfxCmdQueue& queue, int width, int height, bool damageOnly)
+{
+    GLStateCache& gl = state.gl;
+    gl.useProgram(state.program);
+    if (gl.changed(state.viewportSize[0] != width || state.viewportSize[1] != height))
+    {
+        state.viewportSize[0] = (float)width;
+        state.viewportSize[1] = (float)height;
+        glUniform2f(state.programViewportLocation, (float) width, (float) height);
+    }
+    gl.bindTexture(0, state.ftex);
+    if (state.vao)
+    {
+        gl.bindVertexArray(state.vao);
+    }
+    for (GLuint i = 0; i < VERTEX_ATTRIBS; ++i)
+    {
+        gl.enableAttrib(i, true);
+    }
+
+    // An unchanged frame draws the stream already on the GPU again.
+    stats.drawCalls = 0;
+    stats.uploadBytes = 0;
+    if (damageOnly || !queue.unchanged || !state.streamValid || state.streamPulled ||
+        state.streamSdf != sdfShapes || state.streamMsaa != msaa ||
+        queue.hash != state.streamHash || queue.size() != state.streamCommands)
+    {
+        sortCommands(queue);
+        do
+        {
+            stats = RenderStats();
+            state.clips.clear();
+            state.next = DrawCall();
+            state.draws.clear();
+            beginStream();
+            if (damageOnly)
+            {
+                for (const gfxDamageRect& damage : queue.damage)
+                {
+                    tessellateCommands(queue, &damage);
+                }
+            }
+            else
+            {
+                tessellateCommands(queue, nullptr);
+            }
+        }
+        while (!uploadStream());
+        state.streamValid = !damageOnly;
+        state.streamPulled = false;
+        state.streamSdf = sdfShapes;
+        state.streamMsaa = msaa;
+        state.streamHash = queue.hash;
+        state.streamCommands = queue.size();
+    }
+
+    gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.useRing ? state.ring : state.ibo);
+    setVertexFormat(state.useRing ? state.ring : state.vbo, state.vertexOffset);
+    drawStream();
+    if (state.useRing)
+    {
+        // Replaying an unchanged frame reads the region again.
+        if (state.ringFences[state.ringRegion])
+        {
+            glDeleteSync(state.ringFences[state.ringRegion]);
+        }
+        state.ringFences[state.ringRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+void ImguiRenderGL3::draw(const Imgui& imgui, int width, int height, bool damageOnly)
+{
+    GLStateCache& gl = state.gl;
+    gl.invalidate(state.vao != 0);
+    gl.issued = 0;
+    gl.elided = 0;
+
+    gl.setViewport(0, 0, width, height);
+    if (vertexPulling && state.pullProgram && !damageOnly)
+    {
+        drawPulled(imgui.frameQueue, width, height);
+    }
+    else
+    {
+        drawTessellated(imgui.frameQueue, width, height, damageOnly);
+    }
+    gl.enableScissor(false);
+
+    // The VAO keeps its attributes enabled for the next frame.
+    if (state.vao)
+    {
+        gl.bindVertexArray(0);
+    }
+    else
+    {
+        for (GLuint i = 0; i < VERTEX_ATTRIBS; ++i)
+        {
+            gl.enableAttrib(i, false);
+        }
+    }
+    if (gl.changed(gl.activeUnit != 0))
+    {
+        gl.activeUnit = 0;
+        glActiveTexture(GL_TEXTURE0);
+    }
+    gl.useProgram(0);
+
+    stats.glCalls = gl.issued;
+    stats.glCallsElided = gl.elided;
 }
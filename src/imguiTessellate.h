@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2009-2010 Mikko Mononen memon@inside.org
+//
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+//
+
+// Source altered and distributed from https://github.com/AdrienHerubel/imgui
+
+// Heavily modified Luca Deltodesco 2014 https://github.com/deltaluca/imgui
+
+// Polygon tessellation of ImguiRenderGL3 on plain arrays, shared with
+// samples/bench.cpp. Not part of the public headers.
+
+#ifndef IMGUI_TESSELLATE_H
+#define IMGUI_TESSELLATE_H
+
+#include "imguiRenderGL3.h"
+
+namespace imgui
+{
+    // normals[i] becomes the outward normal of the edge from point i to i + 1.
+    void polygonNormals(const float* coords, unsigned n, float* normals);
+
+    // Moves each point r along the miter of its two edges' normals.
+    void polygonMiters(const float* coords, const float* normals, unsigned n, float r, float* out);
+
+    // Grows bounds, as min x, min y, max x, max y, to include n points.
+    void growBounds(const float* coords, unsigned n, float* bounds);
+
+    // Writes the n vertices at the given points. With bounds their UVs map the
+    // bounds onto tx0, ty0 .. tx1, ty1; solid fills, whose UVs the shader
+    // ignores, get 0.
+    void polygonVertices(const float* coords, unsigned n, const float* bounds, float tx0, float ty0, float tx1, float ty1,
+                         uint32_t col, uint8_t mode, uint8_t clip, Vertex* v);
+
+    inline unsigned fringedPolygonIndexCount(unsigned n)
+    {
+        return n * 6 + (n - 2) * 3;
+    }
+
+    // Writes the 2n vertices of a polygon and its AA fringe, whose points
+    // polygonMiters() gave, and the fringedPolygonIndexCount(n) indices
+    // drawing them, numbered from base. VERTEX_TEXTURE maps the bounds of
+    // both onto tx0, ty0 .. tx1, ty1.
+    void fringedPolygon(const float* coords, const float* fringe, unsigned n, float tx0, float ty0, float tx1, float ty1,
+                        uint32_t col, uint8_t mode, uint8_t clip, Vertex* v, uint32_t base, uint32_t* idx);
+}
+
+#endif
@@ -0,0 +1,153 @@
+// allocations.cpp - public domain
+// Records the sample UI with operator new counting, and checks that frames
+// after a short warm-up allocate nothing.
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "imgui.h"
+
+static long allocations = 0;
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* p = malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct SampleState
+{
+    bool checked1 = false;
+    bool checked2 = false;
+    bool checked3 = true;
+    bool checked4 = false;
+    float value1 = 50.f;
+    float value2 = 30.f;
+    int scrollArea1 = 0;
+    int scrollArea2 = 0;
+};
+
+// The UI of samples/sample.cpp, without a window.
+static void sampleFrame(imgui::Imgui& gui, SampleState& s, int width, int height, int mouseX, int mouseY)
+{
+    gui.beginFrame(mouseX, mouseY, (imgui::MouseButton)0, 0);
+
+    gui.beginScrollArea("Scroll area", 10, 10, width / 5, height - 20, s.scrollArea1);
+    gui.separatorLine();
+    gui.separator();
+    gui.button("Button");
+    gui.button("Disabled button", false);
+    gui.item("Item");
+    gui.item("Disabled item", false);
+    if (gui.check("Checkbox", s.checked1))
+    {
+        s.checked1 = !s.checked1;
+    }
+    if (gui.check("Disabled checkbox", s.checked2, false))
+    {
+        s.checked2 = !s.checked2;
+    }
+    bool toggle = gui.collapse("Collapse", "subtext", s.checked3);
+    if (s.checked3)
+    {
+        gui.indent();
+        gui.label("Collapsible element");
+        gui.unindent();
+    }
+    if (toggle)
+    {
+        s.checked3 = !s.checked3;
+    }
+    if (gui.collapse("Disabled collapse", "subtext", s.checked4, false))
+    {
+        s.checked4 = !s.checked4;
+    }
+    gui.label("Label");
+    gui.value("Value");
+    gui.slider("Slider", s.value1, 0.f, 100.f, 1.f);
+    gui.slider("Disabled slider", s.value2, 0.f, 100.f, 1.f, false);
+    gui.indent();
+    gui.label("Indented");
+    gui.unindent();
+    gui.label("Unindented");
+    gui.endScrollArea();
+
+    gui.beginScrollArea("Scroll area", 20 + width / 5, 100, width / 5, 510, s.scrollArea2);
+    gui.separatorLine();
+    gui.separator();
+    int first, last;
+    gui.beginClipper(100, 16, first, last);
+    for (int i = first; i < last; ++i)
+    {
+        gui.label("A wall of text");
+    }
+    gui.endClipper();
+    gui.endScrollArea();
+
+    const int x = 30 + width / 5 * 2;
+    gui.drawText(x,       height - 20, imgui::ALIGN_LEFT,   "Free text", imgui::RGBA(32, 192,  32, 192));
+    gui.drawText(x + 100, height - 40, imgui::ALIGN_RIGHT,  "Free text", imgui::RGBA(32,  32, 192, 192));
+    gui.drawText(x + 50,  height - 60, imgui::ALIGN_CENTER, "Free text", imgui::RGBA(192, 32,  32, 192));
+    gui.drawLine(x, height - 80,  x + 100, height - 60,  1.f, imgui::RGBA(32, 192,  32, 192));
+    gui.drawLine(x, height - 100, x + 100, height - 80,  2.f, imgui::RGBA(32,  32, 192, 192));
+    gui.drawLine(x, height - 120, x + 100, height - 100, 3.f, imgui::RGBA(192, 32,  32, 192));
+    gui.drawRoundedRect(x, height - 240, 100, 100, 5.f,  imgui::RGBA(32, 192,  32, 192));
+    gui.drawRoundedRect(x, height - 350, 100, 100, 10.f, imgui::RGBA(32,  32, 192, 192));
+    gui.drawRoundedRect(x, height - 470, 100, 100, 20.f, imgui::RGBA(192, 32,  32, 192));
+    gui.drawRect(x, height - 590, 100, 100, imgui::RGBA(32, 192, 32, 192));
+    gui.drawRect(x, height - 710, 100, 100, imgui::RGBA(32, 32, 192, 192));
+    gui.drawRect(x, height - 830, 100, 100, imgui::RGBA(192, 32, 32, 192));
+
+    gui.endFrame();
+    gui.optimizeGfxCmdQueue();
+}
+
+int main()
+{
+    imgui::Imgui gui;
+    gui.trackDamage = true;
+    SampleState s;
+
+    // The mouse moves over the first area, so frames differ and damage is
+    // tracked, but stay the same size.
+    const int warmup = 3;
+    const int frames = 10;
+    long steady = 0;
+    for (int i = 0; i < warmup + frames; ++i)
+    {
+        if (i == warmup)
+        {
+            steady = allocations;
+        }
+        sampleFrame(gui, s, 1024, 768, 40 + (i & 1) * 10, 700);
+    }
+    steady = allocations - steady;
+
+    printf("allocations: %ld in %d steady-state frames\n", steady, frames);
+    return steady == 0 ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+// damage.cpp - public domain
+// Checks the damage reported when overlapping commands are reordered.
+
+#include <cstdio>
+
+#include "imgui.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+// A and C overlap, B overlaps neither and sits between them.
+static void frame(imgui::Imgui& gui, bool reversed)
+{
+    const unsigned a = imgui::RGBA(192, 32, 32, 192);
+    const unsigned c = imgui::RGBA(32, 32, 192, 192);
+    gui.beginFrame(0, 0, (imgui::MouseButton)0, 0);
+    gui.drawRect(reversed ? 150 : 100, reversed ? 150 : 100, 100, 100, reversed ? c : a);
+    gui.drawRect(400, 400, 100, 100, imgui::RGBA(32, 192, 32, 192));
+    gui.drawRect(reversed ? 100 : 150, reversed ? 100 : 150, 100, 100, reversed ? a : c);
+    gui.endFrame();
+}
+
+int main()
+{
+    imgui::Imgui gui;
+    gui.trackDamage = true;
+
+    frame(gui, false);
+    frame(gui, false);
+    check(gui.frameQueue.damage.empty(), "an unchanged frame reports no damage");
+
+    frame(gui, true);
+    check(!gui.frameQueue.damage.empty(), "swapping non-adjacent overlapping commands reports damage");
+
+    frame(gui, true);
+    check(gui.frameQueue.damage.empty(), "an unchanged reordered frame reports no damage");
+
+    printf("damage: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+// layers.cpp - public domain
+// Checks that a scroll area closes its scissor in the layer it was begun in.
+
+#include <cstdio>
+
+#include "imgui.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+static int scissors(const std::vector<imgui::gfxCmd>& layer, bool enabled)
+{
+    int n = 0;
+    for (const imgui::gfxCmd& cmd : layer)
+    {
+        if (cmd.type == imgui::GFXCMD_SCISSOR && (cmd.flags != 0) == enabled)
+        {
+            ++n;
+        }
+    }
+    return n;
+}
+
+int main()
+{
+    imgui::Imgui gui;
+    int scroll = 0;
+
+    gui.beginFrame(0, 0, (imgui::MouseButton)0, 0);
+    gui.beginScrollArea("Area", 10, 10, 200, 200, scroll);
+    gui.label("Main");
+    gui.setLayer(imgui::LAYER_OVERLAY);
+    gui.label("Overlay");
+    gui.endScrollArea();
+
+    const auto& main = gui.renderQueue.layers[imgui::LAYER_MAIN];
+    const auto& overlay = gui.renderQueue.layers[imgui::LAYER_OVERLAY];
+    check(scissors(main, true) == 1 && scissors(main, false) == 1, "the main layer opens and closes the scissor");
+    check(scissors(overlay, true) == 0 && scissors(overlay, false) == 0, "the overlay layer records no scissor");
+    check(gui.state.layer == imgui::LAYER_OVERLAY, "endScrollArea() keeps the current layer");
+    gui.endFrame();
+
+    printf("layers: %d failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}